@@ -0,0 +1,120 @@
+// Boot time estimate, for the startup code copying initialized data from
+// flash to RAM and zeroing uninitialized variables before setup() runs
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "minimal_elf.h"
+#include "teensy_size.h"
+
+// Approximate throughput of the startup copy and zero loops, in MB/sec
+// (bytes per microsecond).  These run early in startup, before the CPU
+// is switched to its full speed on Teensy 2.0 & 3.x, and while Teensy 4.x
+// is still reading code through the FlexSPI from flash.
+static const struct {
+	int model;
+	double copy_rate;
+	double zero_rate;
+} boot_rates[] = {
+	{0x19,   2.0,   4.0},	// Teensy 1.0
+	{0x1A,   2.0,   4.0},	// Teensy++ 1.0
+	{0x1B,   2.0,   4.0},	// Teensy 2.0
+	{0x1C,   2.0,   4.0},	// Teensy++ 2.0
+	{0x1D,  16.0,  24.0},	// Teensy 3.0
+	{0x1E,  16.0,  24.0},	// Teensy 3.1
+	{0x1F,  16.0,  24.0},	// Teensy 3.5
+	{0x20,  10.0,  16.0},	// Teensy LC
+	{0x21,  16.0,  24.0},	// Teensy 3.2
+	{0x22,  16.0,  24.0},	// Teensy 3.6
+	{0x24,  50.0, 400.0},	// Teensy 4.0
+	{0x25,  50.0, 400.0},	// Teensy 4.1
+	{0x26,  50.0, 400.0},	// Teensy MicroMod
+};
+
+typedef struct {
+	const char *section;
+	const char *region;
+	int zero;		// 1 = zero filled, 0 = copied from flash
+} boot_step_t;
+
+static const boot_step_t teensy4_steps[] = {
+	{".text.itcm", "RAM1", 0},
+	{".ARM.exidx", "RAM1", 0},
+	{".data",      "RAM1", 0},
+	{".bss",       "RAM1", 1},
+	{".bss.dma",   "RAM2", 1},
+	{NULL, NULL, 0}
+};
+
+static const boot_step_t teensy3_steps[] = {
+	{".data", "RAM", 0},
+	{".bss",  "RAM", 1},
+	{NULL, NULL, 0}
+};
+
+// measure the startup work for the currently loaded ELF file.
+// Rates greater than zero override the model's default rates.
+int boot_cost_measure(int model, double copy_rate, double zero_rate, boot_cost_t *bc)
+{
+	const boot_step_t *steps;
+	unsigned int i;
+
+	memset(bc, 0, sizeof(boot_cost_t));
+	if (model == 0x24 || model == 0x25 || model == 0x26) {
+		steps = teensy4_steps;
+	} else if (model >= 0x19 && model <= 0x22) {
+		steps = teensy3_steps;
+	} else {
+		return 0;
+	}
+	for (i=0; i < sizeof(boot_rates) / sizeof(boot_rates[0]); i++) {
+		if (boot_rates[i].model == model) {
+			bc->copy_rate = boot_rates[i].copy_rate;
+			bc->zero_rate = boot_rates[i].zero_rate;
+		}
+	}
+	if (copy_rate > 0) bc->copy_rate = copy_rate;
+	if (zero_rate > 0) bc->zero_rate = zero_rate;
+	if (bc->copy_rate <= 0 || bc->zero_rate <= 0) return 0;
+
+	for (i=0; steps[i].section && i < BOOT_COST_MAX_STEPS; i++) {
+		uint32_t size = elf_section_size(steps[i].section);
+		bc->section[i] = steps[i].section;
+		bc->region[i] = steps[i].region;
+		bc->zero[i] = steps[i].zero;
+		bc->size[i] = size;
+		bc->usec[i] = size / (steps[i].zero ? bc->zero_rate : bc->copy_rate);
+		if (steps[i].zero) bc->zeroed += size;
+		else bc->copied += size;
+		bc->total_usec += bc->usec[i];
+	}
+	bc->count = i;
+	return 1;
+}
+
+void boot_cost_report(const boot_cost_t *bc, const boot_cost_t *baseline)
+{
+	int i;
+
+	if (bc->count == 0) {
+		report("Boot time: unknown for this model");
+		return;
+	}
+	report("Boot time estimate, copy %.1f MB/sec, zero %.1f MB/sec:",
+		bc->copy_rate, bc->zero_rate);
+	for (i=0; i < bc->count; i++) {
+		if (bc->size[i] == 0) continue;
+		report("  %s %-11s %-4s %8u bytes %9.1f us", bc->zero[i] ? "zero" : "copy",
+			bc->section[i], bc->region[i], bc->size[i], bc->usec[i]);
+	}
+	report("  Total: %u bytes copied, %u bytes zeroed, %.1f us",
+		bc->copied, bc->zeroed, bc->total_usec);
+	if (baseline && baseline->count > 0) {
+		report("  Change from baseline: copied %+d bytes, zeroed %+d bytes, %+.1f us",
+			(int32_t)(bc->copied - baseline->copied),
+			(int32_t)(bc->zeroed - baseline->zeroed),
+			bc->total_usec - baseline->total_usec);
+	}
+}
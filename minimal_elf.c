@@ -3,6 +3,11 @@
 #include <stdint.h>
 #include <string.h>
 #include <sys/param.h>
+#if defined(__linux__) || defined(__APPLE__)
+#define SYMTAB_THREADS
+#include <unistd.h>
+#include <pthread.h>
+#endif
 
 #include "minimal_elf.h"
 
@@ -92,44 +97,292 @@ static inline uint32_t get_32(const unsigned char **ptr)
 
 
 
-int elf_get_symbol(const char *name, uint32_t *value)
+// The symbol table is scanned in chunks of SYMTAB_CHUNK symbols (16 kbytes,
+// small enough to stay in cache).  With more than one job, the chunks are
+// shared among threads, each writing only its own chunk's results, which
+// are then combined in chunk order so the result is the same as a serial
+// scan.  The threads are started on the first large scan and then wait
+// for later scans, since elf_get_symbol() may be called many times.
+// Threads are only used on Linux and MacOS, elsewhere (Windows) every
+// scan is done by a single thread.
+#define SYMTAB_CHUNK	1024
+#define MAX_JOBS	64
+
+static int elf_jobs=1;
+
+typedef struct {
+	void (*work)(uint32_t first, uint32_t last, uint32_t chunk, void *arg);
+	void *arg;
+	uint32_t num_symbols;
+	uint32_t num_chunks;
+	uint32_t next_chunk;	// next chunk to claim, updated atomically
+} symtab_job_t;
+
+// set the number of threads used to scan the symbol table, 0 = one per CPU
+void elf_set_jobs(int jobs)
 {
-	static const elf_section_t *symtab_section=NULL, *strtab_section=NULL;
-	const unsigned char *p, *section_begin, *section_end;
-	const char *strtab;
-	uint32_t st_name, st_value;
-	static const char *cache_name=NULL;
-	static uint32_t cache_value=0;
+#ifdef SYMTAB_THREADS
+	if (jobs <= 0) jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs < 1) jobs = 1;
+	if (jobs > MAX_JOBS) jobs = MAX_JOBS;
+#else
+	jobs = 1;
+#endif
+	elf_jobs = jobs;
+}
 
-	if (!name) return 0;
-	if (cache_name && strcmp(name, cache_name) == 0) {
-		if (value) *value = cache_value;
-		return 1;
+static void * symtab_thread(void *arg)
+{
+	symtab_job_t *job = (symtab_job_t *)arg;
+	uint32_t chunk, first, last;
+
+	while ((chunk = __atomic_fetch_add(&job->next_chunk, 1, __ATOMIC_RELAXED)) < job->num_chunks) {
+		first = chunk * SYMTAB_CHUNK;
+		last = MIN(first + SYMTAB_CHUNK, job->num_symbols);
+		job->work(first, last, chunk, job->arg);
 	}
-	if (value) *value = 0;
+	return NULL;
+}
+
+#ifdef SYMTAB_THREADS
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static symtab_job_t *pool_job;
+static unsigned int pool_generation=0;	// incremented for each new job
+static int pool_size=0;			// number of threads in the pool
+static int pool_busy=0;			// threads still working on pool_job
 
+static void * pool_thread(void *arg)
+{
+	unsigned int generation = 0;
+	symtab_job_t *job;
+
+	pthread_mutex_lock(&pool_lock);
+	while (1) {
+		while (pool_generation == generation) pthread_cond_wait(&pool_start, &pool_lock);
+		generation = pool_generation;
+		job = pool_job;
+		pthread_mutex_unlock(&pool_lock);
+		symtab_thread(job);
+		pthread_mutex_lock(&pool_lock);
+		if (--pool_busy == 0) pthread_cond_signal(&pool_done);
+	}
+	return NULL;
+}
+#endif
+
+// call work() for every chunk of the symbol table, in no particular order.
+// Returns the number of chunks.
+static uint32_t symtab_for_each_chunk(uint32_t num_symbols,
+	void (*work)(uint32_t first, uint32_t last, uint32_t chunk, void *arg), void *arg)
+{
+	symtab_job_t job;
+
+	job.work = work;
+	job.arg = arg;
+	job.num_symbols = num_symbols;
+	job.num_chunks = (num_symbols + SYMTAB_CHUNK - 1) / SYMTAB_CHUNK;
+	job.next_chunk = 0;
+#ifdef SYMTAB_THREADS
+	if (pool_size == 0) {
+		pthread_t thread;
+		while (pool_size < elf_jobs - 1) {
+			if (pthread_create(&thread, NULL, pool_thread, NULL) != 0) break;
+			pthread_detach(thread);
+			pool_size++;
+		}
+	}
+	if (pool_size > 0) {
+		pthread_mutex_lock(&pool_lock);
+		pool_job = &job;
+		pool_busy = pool_size;
+		pool_generation++;
+		pthread_cond_broadcast(&pool_start);
+		pthread_mutex_unlock(&pool_lock);
+	}
+	symtab_thread(&job); // this thread works too, and finishes alone if needed
+	if (pool_size > 0) {
+		pthread_mutex_lock(&pool_lock);
+		while (pool_busy > 0) pthread_cond_wait(&pool_done, &pool_lock);
+		pthread_mutex_unlock(&pool_lock);
+	}
+#else
+	symtab_thread(&job);
+#endif
+	return job.num_chunks;
+}
+
+// lookup caches, cleared by parse_elf() when a new file is parsed
+static const elf_section_t *symtab_section=NULL, *strtab_section=NULL;
+static const char *cache_name=NULL;
+static uint32_t cache_value=0;
+
+// find .symtab and .strtab, returns 0 if either is missing or unusable.
+// The string table must end with a null, so no name runs past its end.
+static int find_symbol_tables(void)
+{
 	if (!symtab_section) symtab_section = find_elf_section(".symtab");
 	if (!strtab_section) strtab_section = find_elf_section(".strtab");
 	if (!symtab_section || !strtab_section) return 0;
+	if (symtab_section->type == 8 || strtab_section->type == 8) return 0;
+	if (strtab_section->size == 0) return 0;
+	return strtab_section->ptr[strtab_section->size - 1] == 0;
+}
+
+// find the first symbol named name, from symbol first up to last
+static int find_symbol(const char *name, uint32_t first, uint32_t last, uint32_t *index)
+{
+	const unsigned char *p, *sym;
+	const char *strtab;
+	uint32_t st_name, i;
 
-	section_begin = p = symtab_section->ptr;
-	section_end = section_begin + symtab_section->size;
+	sym = symtab_section->ptr + first * 16;
 	strtab = (const char *)(strtab_section->ptr);
-	while (p + 16 <= section_end) {
+	for (i=first; i < last; i++, sym += 16) {
+		p = sym;
 		st_name = GET32(p);
-		st_value = GET32(p);
-		p += 8; // st_size, st_info, st_other, st_shndx
-		if (st_name > strtab_section->size) continue;
+		if (st_name >= strtab_section->size) continue;
 		if (strcmp(name, strtab + st_name) == 0) {
-			cache_name = strtab + st_name;
-			cache_value = st_value;
-			if (value) *value = st_value;
+			*index = i;
 			return 1;
 		}
 	}
 	return 0;
 }
 
+typedef struct {
+	const char *name;
+	uint32_t found;		// lowest index found so far, updated atomically
+} find_job_t;
+
+static void find_chunk(uint32_t first, uint32_t last, uint32_t chunk, void *arg)
+{
+	find_job_t *job = (find_job_t *)arg;
+	uint32_t index, found;
+
+	// an earlier chunk already has a match, no need to look here
+	if (__atomic_load_n(&job->found, __ATOMIC_RELAXED) < first) return;
+	if (!find_symbol(job->name, first, last, &index)) return;
+	found = __atomic_load_n(&job->found, __ATOMIC_RELAXED);
+	while (index < found && !__atomic_compare_exchange_n(&job->found, &found, index,
+	  0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) ;
+}
+
+int elf_get_symbol(const char *name, uint32_t *value)
+{
+	const unsigned char *p;
+	uint32_t num, index;
+
+	if (!name) return 0;
+	if (cache_name && strcmp(name, cache_name) == 0) {
+		if (value) *value = cache_value;
+		return 1;
+	}
+	if (value) *value = 0;
+
+	if (!find_symbol_tables()) return 0;
+
+	num = symtab_section->size / 16;
+	if (elf_jobs > 1 && num > SYMTAB_CHUNK) {
+		find_job_t job;
+		job.name = name;
+		job.found = UINT32_MAX;
+		symtab_for_each_chunk(num, find_chunk, &job);
+		if (job.found == UINT32_MAX) return 0;
+		index = job.found;
+	} else {
+		if (!find_symbol(name, 0, num, &index)) return 0;
+	}
+	p = symtab_section->ptr + index * 16;
+	cache_name = (const char *)(strtab_section->ptr) + GET32(p);
+	cache_value = GET32(p);
+	if (value) *value = cache_value;
+	return 1;
+}
+
+
+// copy the symbols from first up to last which are accepted by filter
+static uint32_t collect_symbols(uint32_t first, uint32_t last,
+	int (*filter)(const elf_symbol_t *sym, void *arg), void *arg, elf_symbol_t *out)
+{
+	const unsigned char *p;
+	elf_symbol_t sym;
+	uint32_t st_name, i, count=0;
+
+	p = symtab_section->ptr + first * 16;
+	for (i=first; i < last; i++) {
+		st_name = GET32(p);
+		sym.value = GET32(p);
+		sym.size = GET32(p);
+		sym.info = GET8(p);
+		sym.other = GET8(p);
+		sym.shndx = GET16(p);
+		if (st_name >= strtab_section->size) continue;
+		sym.name = (const char *)(strtab_section->ptr) + st_name;
+		if (filter && !filter(&sym, arg)) continue;
+		out[count++] = sym;
+	}
+	return count;
+}
+
+typedef struct {
+	int (*filter)(const elf_symbol_t *sym, void *arg);
+	void *arg;
+	elf_symbol_t *out;
+	uint32_t *counts;	// number of symbols found in each chunk
+} collect_job_t;
+
+static void collect_chunk(uint32_t first, uint32_t last, uint32_t chunk, void *arg)
+{
+	collect_job_t *job = (collect_job_t *)arg;
+
+	// each chunk's symbols go in its own part of the list
+	job->counts[chunk] = collect_symbols(first, last, job->filter, job->arg, job->out + first);
+}
+
+// copy every symbol accepted by filter into a newly allocated list,
+// in symbol table order.  Returns the number of symbols, or -1 if
+// the symbol table is missing or memory can't be allocated.  With
+// more than one job, filter is called from several threads at once.
+int elf_collect_symbols(int (*filter)(const elf_symbol_t *sym, void *arg),
+	void *arg, elf_symbol_t **list)
+{
+	elf_symbol_t *out;
+	uint32_t count=0, num;
+
+	*list = NULL;
+	if (!find_symbol_tables()) return -1;
+	num = symtab_section->size / 16;
+	out = malloc((num ? num : 1) * sizeof(elf_symbol_t));
+	if (!out) return -1;
+
+	if (elf_jobs > 1 && num > SYMTAB_CHUNK) {
+		collect_job_t job;
+		uint32_t chunk, num_chunks;
+		job.filter = filter;
+		job.arg = arg;
+		job.out = out;
+		job.counts = malloc(((num + SYMTAB_CHUNK - 1) / SYMTAB_CHUNK) * sizeof(uint32_t));
+		if (!job.counts) {
+			free(out);
+			return -1;
+		}
+		num_chunks = symtab_for_each_chunk(num, collect_chunk, &job);
+		// merge in chunk order, the same order as a serial scan
+		for (chunk=0; chunk < num_chunks; chunk++) {
+			memmove(out + count, out + chunk * SYMTAB_CHUNK,
+				job.counts[chunk] * sizeof(elf_symbol_t));
+			count += job.counts[chunk];
+		}
+		free(job.counts);
+	} else {
+		count = collect_symbols(0, num, filter, arg, out);
+	}
+	*list = out;
+	return count;
+}
+
 
 // inspect the symbol table, counting the interrupt vectors
 int elf_teensy_model_id(const unsigned char *elf_unused)
@@ -171,6 +424,10 @@ int elf_teensy_model_id(const unsigned char *elf_unused)
 }
 
 
+int elf_get_architecture(void)
+{
+	return elf_architecture;
+}
 
 static const elf_section_t * find_elf_section(const char *name)
 {
@@ -284,7 +541,7 @@ int get_elf_eeprom(uint8_t *buffer, int bufsize)
 }
 
 
-int parse_elf(const unsigned char *elf)
+int parse_elf(const unsigned char *elf, uint32_t filesize)
 {
 	const unsigned char *p, *q;
 	uint16_t type;
@@ -293,6 +550,7 @@ int parse_elf(const unsigned char *elf)
 	unsigned int i, len, size;
 
 	//printf("parse_elf begin\n");
+	if (filesize < 52) return -9;	// file truncated
 	if (elf[0] != 0x7F || elf[1] != 'E' || elf[2] != 'L' || elf[3] != 'F')
 		return -1;	// missing ELF magic number
 	if (elf[4] != 1) {
@@ -310,6 +568,9 @@ int parse_elf(const unsigned char *elf)
 		return -3;	// file is unknown format
 	}
 
+	symtab_section = strtab_section = NULL;
+	cache_name = NULL;
+
 	// read file header
 	p = elf + 16;
 
@@ -333,6 +594,10 @@ int parse_elf(const unsigned char *elf)
 
 	// read section headers
 	if (elf_section_count > MAX_ELF_SECTIONS) elf_section_count = MAX_ELF_SECTIONS;
+	if ((uint64_t)section_header_offset + elf_section_count * section_header_size > filesize) {
+		elf_section_count = elf_segment_count = 0;
+		return -9;	// section headers past end of file (truncated)
+	}
 	q = elf + section_header_offset;
 	section = elf_sections;
 	for (i=0; i<elf_section_count; i++) {
@@ -349,6 +614,11 @@ int parse_elf(const unsigned char *elf)
 		section->entry_size = GETSZ(p);
 		section->ptr = elf + section->offset;
 		section->name = "";
+		if (section->type != 8 // 8=NOBITS, no data in the file
+		  && (uint64_t)section->offset + section->size > filesize) {
+			elf_section_count = elf_segment_count = 0;
+			return -9;	// section data past end of file
+		}
 		q += section_header_size;
 		section++;
 	}
@@ -356,7 +626,9 @@ int parse_elf(const unsigned char *elf)
 	// fill in the section name fields with pointers to string segment
 	if (string_section_index > 0
 	  && string_section_index < elf_section_count
-	  && elf_sections[string_section_index].size > 0) {
+	  && elf_sections[string_section_index].size > 0
+	  && elf_sections[string_section_index].type != 8
+	  && elf_sections[string_section_index].ptr[elf_sections[string_section_index].size - 1] == 0) {
 		q = elf_sections[string_section_index].ptr;
 		section = elf_sections;
 		len = elf_sections[string_section_index].size;
@@ -370,6 +642,10 @@ int parse_elf(const unsigned char *elf)
 
 	// read segment headers
 	if (elf_segment_count > MAX_ELF_SEGMENTS) elf_segment_count = MAX_ELF_SEGMENTS;
+	if ((uint64_t)segment_header_offset + elf_segment_count * segment_header_size > filesize) {
+		elf_section_count = elf_segment_count = 0;
+		return -9;	// segment headers past end of file
+	}
 	q = elf + segment_header_offset;
 	segment = elf_segments;
 	for (i=0; i<elf_segment_count; i++) {
@@ -383,6 +659,10 @@ int parse_elf(const unsigned char *elf)
                 segment->flags = GET32(p);
                 segment->alignment = GET32(p);
 		segment->ptr = elf + segment->offset;
+		if ((uint64_t)segment->offset + segment->file_size > filesize) {
+			elf_section_count = elf_segment_count = 0;
+			return -9;	// segment data past end of file
+		}
 		if (segment->file_size > 0) {
 			section = elf_find_section_by_segment(segment);
 			if (!section) return -8;
@@ -405,6 +685,51 @@ uint32_t elf_section_size(const char *name)
 	return 0;
 }
 
+// return a pointer to the contents of a section in the file image,
+// or NULL if the section doesn't exist or has no file data
+const unsigned char * elf_section_data(const char *name, uint32_t *size, uint32_t *flags)
+{
+	const elf_section_t *section = find_elf_section(name);
+	if (size) *size = 0;
+	if (flags) *flags = 0;
+	if (!section || section->type == 8) return NULL; // 8=NOBITS
+	if (size) *size = section->size;
+	if (flags) *flags = section->flags;
+	return section->ptr;
+}
+
+// get info about a section by index, returns 0 when index is past the end.
+// data is NULL for sections which occupy no space in the file (.bss).
+int elf_get_section(unsigned int index, const char **name, uint32_t *addr,
+	uint32_t *size, uint32_t *flags, const unsigned char **data)
+{
+	const elf_section_t *section;
+
+	if (index >= elf_section_count) return 0;
+	section = elf_sections + index;
+	if (name) *name = section->name;
+	if (addr) *addr = section->addr;
+	if (size) *size = section->size;
+	if (flags) *flags = section->flags;
+	if (data) *data = (section->type == 8) ? NULL : section->ptr;
+	return 1;
+}
+
+// name of the allocated section holding an address, or NULL
+const char * elf_section_name_at(uint32_t addr)
+{
+	const elf_section_t *section;
+	int i;
+
+	for (i=0,section=elf_sections; i<elf_section_count; i++,section++) {
+		if ((section->flags & SHF_ALLOC) == 0) continue;
+		if (addr >= section->addr && addr - section->addr < section->size) {
+			return section->name;
+		}
+	}
+	return NULL;
+}
+
 #if 1
 void print_elf_info(void)
 {
@@ -3,13 +3,40 @@
 
 #include <stdint.h>
 
+typedef struct {
+	const char *name;
+	uint32_t value;
+	uint32_t size;
+	uint8_t info;		// binding in upper 4 bits, type in lower 4 bits
+	uint8_t other;
+	uint16_t shndx;		// index of section holding this symbol
+} elf_symbol_t;
+
+#define ELF_ST_TYPE(info)	((info) & 15)
+#define ELF_ST_BIND(info)	((info) >> 4)
+#define STT_OBJECT	1
+#define STT_FUNC	2
+
+#define SHF_WRITE	0x0001
+#define SHF_ALLOC	0x0002
+#define SHF_EXECINSTR	0x0004
+#define SHF_COMPRESSED	0x0800
+
 int elf_teensy_model_id(const unsigned char *elf);
+int elf_get_architecture(void);
+void elf_set_jobs(int jobs);
 int elf_get_symbol(const char *name, uint32_t *value);
+int elf_collect_symbols(int (*filter)(const elf_symbol_t *sym, void *arg),
+	void *arg, elf_symbol_t **list);
 int is_elf_binary(uint32_t addr, unsigned int len);
 void get_elf_binary(uint32_t addr, int len, unsigned char *buffer);
 int get_elf_eeprom(uint8_t *buffer, int size);
-int parse_elf(const unsigned char *elf);
+int parse_elf(const unsigned char *elf, uint32_t filesize);
 uint32_t elf_section_size(const char *name);
+const unsigned char * elf_section_data(const char *name, uint32_t *size, uint32_t *flags);
+int elf_get_section(unsigned int index, const char **name, uint32_t *addr,
+	uint32_t *size, uint32_t *flags, const unsigned char **data);
+const char * elf_section_name_at(uint32_t addr);
 void print_elf_info(void);
 
 #endif
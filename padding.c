@@ -0,0 +1,1015 @@
+// Struct padding analysis for the largest RAM variables, similar to "pahole"
+//
+// Only .debug_info and .debug_abbrev (plus the string sections for names)
+// are parsed, directly from the ELF file already in memory.  The DIEs
+// are skimmed using precomputed attribute sizes, and only variables and
+// the types reachable from the chosen variables are fully decoded, so
+// even very large debug builds are quick to analyze.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "minimal_elf.h"
+#include "teensy_size.h"
+
+#define DW_TAG_array_type		0x01
+#define DW_TAG_class_type		0x02
+#define DW_TAG_member			0x0d
+#define DW_TAG_pointer_type		0x0f
+#define DW_TAG_reference_type		0x10
+#define DW_TAG_compile_unit		0x11
+#define DW_TAG_structure_type		0x13
+#define DW_TAG_typedef			0x16
+#define DW_TAG_union_type		0x17
+#define DW_TAG_inheritance		0x1c
+#define DW_TAG_subrange_type		0x21
+#define DW_TAG_const_type		0x26
+#define DW_TAG_variable			0x34
+#define DW_TAG_volatile_type		0x35
+#define DW_TAG_restrict_type		0x37
+#define DW_TAG_rvalue_reference_type	0x42
+#define DW_TAG_atomic_type		0x47
+
+#define DW_AT_sibling			0x01
+#define DW_AT_location			0x02
+#define DW_AT_name			0x03
+#define DW_AT_byte_size			0x0b
+#define DW_AT_bit_offset		0x0c
+#define DW_AT_bit_size			0x0d
+#define DW_AT_upper_bound		0x2f
+#define DW_AT_abstract_origin		0x31
+#define DW_AT_count			0x37
+#define DW_AT_data_member_location	0x38
+#define DW_AT_specification		0x47
+#define DW_AT_type			0x49
+#define DW_AT_data_bit_offset		0x6b
+#define DW_AT_str_offsets_base		0x72
+#define DW_AT_alignment			0x88
+
+#define DW_FORM_addr			0x01
+#define DW_FORM_block2			0x03
+#define DW_FORM_block4			0x04
+#define DW_FORM_data2			0x05
+#define DW_FORM_data4			0x06
+#define DW_FORM_data8			0x07
+#define DW_FORM_string			0x08
+#define DW_FORM_block			0x09
+#define DW_FORM_block1			0x0a
+#define DW_FORM_data1			0x0b
+#define DW_FORM_flag			0x0c
+#define DW_FORM_sdata			0x0d
+#define DW_FORM_strp			0x0e
+#define DW_FORM_udata			0x0f
+#define DW_FORM_ref_addr		0x10
+#define DW_FORM_ref1			0x11
+#define DW_FORM_ref2			0x12
+#define DW_FORM_ref4			0x13
+#define DW_FORM_ref8			0x14
+#define DW_FORM_ref_udata		0x15
+#define DW_FORM_indirect		0x16
+#define DW_FORM_sec_offset		0x17
+#define DW_FORM_exprloc			0x18
+#define DW_FORM_flag_present		0x19
+#define DW_FORM_strx			0x1a
+#define DW_FORM_addrx			0x1b
+#define DW_FORM_ref_sup4		0x1c
+#define DW_FORM_strp_sup		0x1d
+#define DW_FORM_data16			0x1e
+#define DW_FORM_line_strp		0x1f
+#define DW_FORM_ref_sig8		0x20
+#define DW_FORM_implicit_const		0x21
+#define DW_FORM_loclistx		0x22
+#define DW_FORM_rnglistx		0x23
+#define DW_FORM_ref_sup8		0x24
+#define DW_FORM_strx1			0x25
+#define DW_FORM_strx2			0x26
+#define DW_FORM_strx3			0x27
+#define DW_FORM_strx4			0x28
+#define DW_FORM_addrx1			0x29
+#define DW_FORM_addrx2			0x2a
+#define DW_FORM_addrx3			0x2b
+#define DW_FORM_addrx4			0x2c
+#define DW_FORM_GNU_ref_alt		0x1f20
+#define DW_FORM_GNU_strp_alt		0x1f21
+
+#define DW_OP_addr			0x03
+#define DW_OP_plus_uconst		0x23
+
+typedef struct {
+	uint32_t name;
+	uint32_t form;
+	int64_t implicit_const;
+} dwarf_attr_t;
+
+typedef struct {
+	uint32_t code;
+	uint32_t tag;
+	uint8_t children;
+	int32_t fixed_size;	// bytes of attribute data, or -1 if it varies
+	uint32_t attr_count;
+	dwarf_attr_t *attr;
+} dwarf_abbrev_t;
+
+typedef struct {
+	uint32_t offset;	// offset of this table within .debug_abbrev
+	uint8_t offset_size;	// unit format the fixed sizes were computed for
+	uint8_t addr_size;
+	uint16_t version;
+	uint32_t count;
+	dwarf_abbrev_t *abbrev;
+} dwarf_abbrev_table_t;
+
+typedef struct {
+	uint32_t offset;	// offset of unit header within .debug_info
+	uint32_t end;		// offset just past the end of this unit
+	uint32_t die_offset;	// offset of the unit's first DIE
+	uint16_t version;
+	uint8_t offset_size;
+	uint8_t addr_size;
+	uint32_t abbrev_offset;
+	uint32_t str_offsets_base;
+	dwarf_abbrev_table_t *abbrevs;
+} dwarf_unit_t;
+
+#define HAS_BYTE_SIZE		0x0001
+#define HAS_COUNT		0x0002
+#define HAS_UPPER_BOUND		0x0004
+#define HAS_MEMBER_LOCATION	0x0008
+#define HAS_BIT_SIZE		0x0010
+#define HAS_BIT_OFFSET		0x0020
+#define HAS_DATA_BIT_OFFSET	0x0040
+#define HAS_LOCATION		0x0080
+
+typedef struct {
+	dwarf_unit_t *unit;
+	uint32_t offset;	// offset of this DIE within .debug_info
+	uint32_t next;		// offset of the DIE which follows in the file
+	uint32_t tag;		// zero for the null entry ending a list of children
+	uint8_t children;
+	uint32_t has;		// HAS_xxx bits for the numeric fields below
+	const char *name;
+	uint32_t type;		// referenced DIEs as .debug_info offsets, 0 = none
+	uint32_t specification;
+	uint32_t abstract_origin;
+	uint32_t sibling;
+	uint32_t byte_size;
+	uint32_t count;
+	uint32_t upper_bound;
+	uint32_t member_location;
+	uint32_t bit_size;
+	uint32_t bit_offset;
+	uint32_t data_bit_offset;
+	uint32_t alignment;
+	uint32_t location;	// static address from a DW_OP_addr location
+} dwarf_die_t;
+
+typedef struct {
+	uint64_t value;
+	const unsigned char *block;	// block and exprloc forms
+	const char *str;		// string forms
+} dwarf_value_t;
+
+static const unsigned char *info, *abbrev_data, *str_data, *line_str_data, *str_offsets_data;
+static uint32_t info_size, abbrev_size, str_size, line_str_size, str_offsets_size;
+static dwarf_unit_t *units;
+static uint32_t unit_count;
+static dwarf_abbrev_table_t **abbrev_tables;
+static uint32_t abbrev_table_count;
+
+
+static uint64_t read_le(const unsigned char *p, int len)
+{
+	uint64_t n = 0;
+	while (len > 0) {
+		len--;
+		n = (n << 8) | p[len];
+	}
+	return n;
+}
+
+static uint64_t read_uleb(const unsigned char **pp, const unsigned char *end)
+{
+	const unsigned char *p = *pp;
+	uint64_t n = 0;
+	int shift = 0;
+	while (p < end) {
+		unsigned char b = *p++;
+		if (shift < 64) n |= (uint64_t)(b & 0x7F) << shift;
+		shift += 7;
+		if (!(b & 0x80)) break;
+	}
+	*pp = p;
+	return n;
+}
+
+static int64_t read_sleb(const unsigned char **pp, const unsigned char *end)
+{
+	const unsigned char *p = *pp;
+	int64_t n = 0;
+	int shift = 0;
+	unsigned char b = 0;
+	while (p < end) {
+		b = *p++;
+		if (shift < 64) n |= (int64_t)(b & 0x7F) << shift;
+		shift += 7;
+		if (!(b & 0x80)) break;
+	}
+	if (shift < 64 && (b & 0x40)) n |= -((int64_t)1 << shift);
+	*pp = p;
+	return n;
+}
+
+// size of an attribute's data when it doesn't depend on the data, or -1
+static int form_fixed_size(uint32_t form, int version, int offset_size, int addr_size)
+{
+	switch (form) {
+	  case DW_FORM_flag_present:
+	  case DW_FORM_implicit_const:
+		return 0;
+	  case DW_FORM_data1: case DW_FORM_ref1: case DW_FORM_flag:
+	  case DW_FORM_strx1: case DW_FORM_addrx1:
+		return 1;
+	  case DW_FORM_data2: case DW_FORM_ref2:
+	  case DW_FORM_strx2: case DW_FORM_addrx2:
+		return 2;
+	  case DW_FORM_strx3: case DW_FORM_addrx3:
+		return 3;
+	  case DW_FORM_data4: case DW_FORM_ref4: case DW_FORM_ref_sup4:
+	  case DW_FORM_strx4: case DW_FORM_addrx4:
+		return 4;
+	  case DW_FORM_data8: case DW_FORM_ref8: case DW_FORM_ref_sig8:
+	  case DW_FORM_ref_sup8:
+		return 8;
+	  case DW_FORM_data16:
+		return 16;
+	  case DW_FORM_addr:
+		return addr_size;
+	  case DW_FORM_ref_addr:
+		return (version <= 2) ? addr_size : offset_size;
+	  case DW_FORM_strp: case DW_FORM_sec_offset: case DW_FORM_line_strp:
+	  case DW_FORM_strp_sup: case DW_FORM_GNU_ref_alt: case DW_FORM_GNU_strp_alt:
+		return offset_size;
+	}
+	return -1;
+}
+
+static const char * string_at(const unsigned char *data, uint32_t size, uint64_t offset)
+{
+	if (!data || offset >= size) return NULL;
+	if (!memchr(data + offset, 0, size - offset)) return NULL;
+	return (const char *)data + offset;
+}
+
+// read (or skip) one attribute value, returns 0 if the data is malformed
+static int read_form(const dwarf_unit_t *unit, uint32_t form, int64_t implicit_const,
+	const unsigned char **pp, const unsigned char *end, dwarf_value_t *v)
+{
+	const unsigned char *p = *pp;
+	uint64_t len;
+	int n;
+
+	v->value = 0;
+	v->block = NULL;
+	v->str = NULL;
+	switch (form) {
+	  case DW_FORM_string:
+		v->str = (const char *)p;
+		p = memchr(p, 0, end - p);
+		if (!p) return 0;
+		p++;
+		break;
+	  case DW_FORM_block1:
+		if (end - p < 1) return 0;
+		len = *p++;
+		goto block;
+	  case DW_FORM_block2:
+		if (end - p < 2) return 0;
+		len = read_le(p, 2);
+		p += 2;
+		goto block;
+	  case DW_FORM_block4:
+		if (end - p < 4) return 0;
+		len = read_le(p, 4);
+		p += 4;
+		goto block;
+	  case DW_FORM_block:
+	  case DW_FORM_exprloc:
+		len = read_uleb(&p, end);
+	  block:
+		if (len > (uint64_t)(end - p)) return 0;
+		v->block = p;
+		v->value = len;
+		p += len;
+		break;
+	  case DW_FORM_sdata:
+		v->value = (uint64_t)read_sleb(&p, end);
+		break;
+	  case DW_FORM_udata:
+	  case DW_FORM_ref_udata:
+	  case DW_FORM_strx:
+	  case DW_FORM_addrx:
+	  case DW_FORM_loclistx:
+	  case DW_FORM_rnglistx:
+		v->value = read_uleb(&p, end);
+		break;
+	  case DW_FORM_indirect:
+		form = read_uleb(&p, end);
+		if (form == DW_FORM_indirect) return 0;
+		*pp = p;
+		return read_form(unit, form, implicit_const, pp, end, v);
+	  case DW_FORM_implicit_const:
+		v->value = (uint64_t)implicit_const;
+		break;
+	  default:
+		n = form_fixed_size(form, unit->version, unit->offset_size, unit->addr_size);
+		if (n < 0 || n > end - p) return 0;
+		if (n <= 8) v->value = read_le(p, n);
+		p += n;
+		break;
+	}
+	if (p > end) return 0;
+	switch (form) {
+	  case DW_FORM_strp:
+		v->str = string_at(str_data, str_size, v->value);
+		break;
+	  case DW_FORM_line_strp:
+		v->str = string_at(line_str_data, line_str_size, v->value);
+		break;
+	  case DW_FORM_strx: case DW_FORM_strx1: case DW_FORM_strx2:
+	  case DW_FORM_strx3: case DW_FORM_strx4:
+		len = unit->str_offsets_base + v->value * unit->offset_size;
+		if (str_offsets_data && len + unit->offset_size <= str_offsets_size) {
+			v->str = string_at(str_data, str_size,
+				read_le(str_offsets_data + len, unit->offset_size));
+		}
+		break;
+	  case DW_FORM_ref1: case DW_FORM_ref2: case DW_FORM_ref4:
+	  case DW_FORM_ref8: case DW_FORM_ref_udata:
+		// unit relative references become .debug_info offsets
+		v->value += unit->offset;
+		break;
+	}
+	*pp = p;
+	return 1;
+}
+
+static dwarf_abbrev_table_t * parse_abbrev_table(const dwarf_unit_t *unit)
+{
+	dwarf_abbrev_table_t *table;
+	const unsigned char *p, *end;
+	dwarf_abbrev_t *ab;
+	uint32_t i, max_abbrevs=0, max_attrs=0;
+	int size;
+
+	for (i=abbrev_table_count; i > 0; i--) {
+		table = abbrev_tables[i-1];
+		if (table->offset == unit->abbrev_offset
+		  && table->offset_size == unit->offset_size
+		  && table->addr_size == unit->addr_size
+		  && table->version == unit->version) return table;
+	}
+	if (unit->abbrev_offset >= abbrev_size) return NULL;
+	table = calloc(1, sizeof(dwarf_abbrev_table_t));
+	if (!table) return NULL;
+	table->offset = unit->abbrev_offset;
+	table->offset_size = unit->offset_size;
+	table->addr_size = unit->addr_size;
+	table->version = unit->version;
+
+	p = abbrev_data + unit->abbrev_offset;
+	end = abbrev_data + abbrev_size;
+	while (p < end) {
+		uint32_t code = read_uleb(&p, end);
+		if (code == 0) break;
+		if (table->count >= max_abbrevs) {
+			max_abbrevs = max_abbrevs ? max_abbrevs * 2 : 64;
+			ab = realloc(table->abbrev, max_abbrevs * sizeof(dwarf_abbrev_t));
+			if (!ab) break;
+			table->abbrev = ab;
+		}
+		ab = table->abbrev + table->count++;
+		ab->code = code;
+		ab->tag = read_uleb(&p, end);
+		ab->children = (p < end) ? *p++ : 0;
+		ab->fixed_size = 0;
+		ab->attr_count = 0;
+		ab->attr = NULL;
+		max_attrs = 0;
+		while (p < end) {
+			uint32_t name = read_uleb(&p, end);
+			uint32_t form = read_uleb(&p, end);
+			int64_t implicit_const = 0;
+			if (form == DW_FORM_implicit_const) implicit_const = read_sleb(&p, end);
+			if (name == 0 && form == 0) break;
+			if (ab->attr_count >= max_attrs) {
+				dwarf_attr_t *attr;
+				max_attrs = max_attrs ? max_attrs * 2 : 8;
+				attr = realloc(ab->attr, max_attrs * sizeof(dwarf_attr_t));
+				if (!attr) break;
+				ab->attr = attr;
+			}
+			ab->attr[ab->attr_count].name = name;
+			ab->attr[ab->attr_count].form = form;
+			ab->attr[ab->attr_count].implicit_const = implicit_const;
+			ab->attr_count++;
+			size = form_fixed_size(form, unit->version, unit->offset_size, unit->addr_size);
+			if (size < 0 || ab->fixed_size < 0) ab->fixed_size = -1;
+			else ab->fixed_size += size;
+		}
+	}
+
+	if ((abbrev_table_count & 63) == 0) {
+		dwarf_abbrev_table_t **list = realloc(abbrev_tables,
+			(abbrev_table_count + 64) * sizeof(dwarf_abbrev_table_t *));
+		if (!list) {
+			free(table->abbrev);
+			free(table);
+			return NULL;
+		}
+		abbrev_tables = list;
+	}
+	abbrev_tables[abbrev_table_count++] = table;
+	return table;
+}
+
+static const dwarf_abbrev_t * find_abbrev(const dwarf_abbrev_table_t *table, uint32_t code)
+{
+	uint32_t i;
+
+	// compilers almost always number abbreviations sequentially from 1
+	if (code <= table->count && table->abbrev[code-1].code == code) {
+		return table->abbrev + code - 1;
+	}
+	for (i=0; i < table->count; i++) {
+		if (table->abbrev[i].code == code) return table->abbrev + i;
+	}
+	return NULL;
+}
+
+// read all the unit headers, without looking at any DIEs
+static int read_unit_headers(void)
+{
+	const unsigned char *p = info, *end = info + info_size, *q;
+	uint32_t max_units = 0;
+	dwarf_unit_t *u;
+
+	while (p + 11 <= end) {
+		uint64_t length = read_le(p, 4);
+		int offset_size = 4;
+		q = p + 4;
+		if (length == 0xFFFFFFFF) {
+			length = read_le(q, 8);
+			offset_size = 8;
+			q += 8;
+		}
+		if (length > (uint64_t)(end - q)) break;
+		if (unit_count >= max_units) {
+			max_units = max_units ? max_units * 2 : 256;
+			u = realloc(units, max_units * sizeof(dwarf_unit_t));
+			if (!u) return -1;
+			units = u;
+		}
+		u = units + unit_count;
+		u->offset = p - info;
+		u->end = (q - info) + length;
+		u->offset_size = offset_size;
+		u->version = read_le(q, 2);
+		u->str_offsets_base = 0;
+		u->abbrevs = NULL;
+		p = q + length;
+		q += 2;
+		if (u->version >= 2 && u->version <= 4) {
+			u->abbrev_offset = read_le(q, offset_size);
+			q += offset_size;
+			u->addr_size = *q++;
+		} else if (u->version == 5) {
+			int unit_type = *q++;
+			u->addr_size = *q++;
+			u->abbrev_offset = read_le(q, offset_size);
+			q += offset_size;
+			if (unit_type == 4 || unit_type == 5) q += 8; // dwo_id
+			if (unit_type == 2 || unit_type == 6) q += 8 + offset_size; // type unit
+		} else {
+			continue; // unknown version, skip this unit
+		}
+		if (q > p) continue;
+		u->die_offset = q - info;
+		unit_count++;
+	}
+	return 0;
+}
+
+static dwarf_unit_t * find_unit(uint32_t offset)
+{
+	uint32_t lo = 0, hi = unit_count;
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (offset < units[mid].offset) hi = mid;
+		else if (offset >= units[mid].end) lo = mid + 1;
+		else return units + mid;
+	}
+	return NULL;
+}
+
+// fully decode the DIE at offset within the given unit
+static int decode_die(dwarf_unit_t *unit, uint32_t offset, dwarf_die_t *die)
+{
+	const unsigned char *p, *end;
+	const dwarf_abbrev_t *ab;
+	dwarf_value_t v;
+	uint32_t i, code;
+
+	memset(die, 0, sizeof(dwarf_die_t));
+	if (!unit) return 0;
+	if (!unit->abbrevs) unit->abbrevs = parse_abbrev_table(unit);
+	if (!unit->abbrevs) return 0;
+	if (offset < unit->die_offset || offset >= unit->end) return 0;
+	die->unit = unit;
+	die->offset = offset;
+	p = info + offset;
+	end = info + unit->end;
+	code = read_uleb(&p, end);
+	if (code == 0) {
+		die->next = p - info;
+		return 1;
+	}
+	ab = find_abbrev(unit->abbrevs, code);
+	if (!ab) return 0;
+	die->tag = ab->tag;
+	die->children = ab->children;
+	for (i=0; i < ab->attr_count; i++) {
+		const dwarf_attr_t *attr = ab->attr + i;
+		if (!read_form(unit, attr->form, attr->implicit_const, &p, end, &v)) return 0;
+		switch (attr->name) {
+		  case DW_AT_name:
+			die->name = v.str;
+			break;
+		  case DW_AT_type:
+			die->type = v.value;
+			break;
+		  case DW_AT_specification:
+			die->specification = v.value;
+			break;
+		  case DW_AT_abstract_origin:
+			die->abstract_origin = v.value;
+			break;
+		  case DW_AT_sibling:
+			die->sibling = v.value;
+			break;
+		  case DW_AT_byte_size:
+			die->byte_size = v.value;
+			die->has |= HAS_BYTE_SIZE;
+			break;
+		  case DW_AT_count:
+			if (v.block) break; // non-constant count
+			die->count = v.value;
+			die->has |= HAS_COUNT;
+			break;
+		  case DW_AT_upper_bound:
+			if (v.block) break;
+			die->upper_bound = v.value;
+			die->has |= HAS_UPPER_BOUND;
+			break;
+		  case DW_AT_data_member_location:
+			if (v.block) {
+				// DWARF 2 style location expression
+				const unsigned char *q = v.block;
+				if (v.value < 2 || *q++ != DW_OP_plus_uconst) break;
+				die->member_location = read_uleb(&q, v.block + v.value);
+			} else {
+				die->member_location = v.value;
+			}
+			die->has |= HAS_MEMBER_LOCATION;
+			break;
+		  case DW_AT_bit_size:
+			die->bit_size = v.value;
+			die->has |= HAS_BIT_SIZE;
+			break;
+		  case DW_AT_bit_offset:
+			die->bit_offset = v.value;
+			die->has |= HAS_BIT_OFFSET;
+			break;
+		  case DW_AT_data_bit_offset:
+			die->data_bit_offset = v.value;
+			die->has |= HAS_DATA_BIT_OFFSET;
+			break;
+		  case DW_AT_alignment:
+			die->alignment = v.value;
+			break;
+		  case DW_AT_location:
+			if (v.block && v.value == 1 + (uint64_t)unit->addr_size
+			  && v.block[0] == DW_OP_addr) {
+				die->location = read_le(v.block + 1, unit->addr_size);
+				die->has |= HAS_LOCATION;
+			}
+			break;
+		  case DW_AT_str_offsets_base:
+			if (ab->tag == DW_TAG_compile_unit) {
+				unit->str_offsets_base = v.value;
+			}
+			break;
+		}
+	}
+	die->next = p - info;
+	return 1;
+}
+
+static int read_die(uint32_t offset, dwarf_die_t *die)
+{
+	return decode_die(find_unit(offset), offset, die);
+}
+
+// offset of the DIE following this one and all its children
+static uint32_t next_sibling(const dwarf_die_t *die, int depth)
+{
+	dwarf_die_t child;
+	uint32_t offset;
+
+	if (!die->children) return die->next;
+	if (die->sibling) return die->sibling;
+	if (depth > 64) return 0;
+	offset = die->next;
+	while (offset) {
+		if (!decode_die(die->unit, offset, &child)) return 0;
+		if (child.tag == 0) return child.next;
+		offset = next_sibling(&child, depth + 1);
+	}
+	return 0;
+}
+
+#define for_each_child(parent, child, offset) \
+	for (offset = (parent)->children ? (parent)->next : 0; \
+	  offset && decode_die((parent)->unit, offset, child) && (child)->tag; \
+	  offset = next_sibling(child, 0))
+
+static int is_type_modifier(uint32_t tag)
+{
+	return tag == DW_TAG_typedef || tag == DW_TAG_const_type
+		|| tag == DW_TAG_volatile_type || tag == DW_TAG_restrict_type
+		|| tag == DW_TAG_atomic_type;
+}
+
+static int is_struct(uint32_t tag)
+{
+	return tag == DW_TAG_structure_type || tag == DW_TAG_class_type
+		|| tag == DW_TAG_union_type;
+}
+
+static uint32_t array_count(const dwarf_die_t *array)
+{
+	dwarf_die_t sub;
+	uint32_t offset, count = 1;
+	int dims = 0;
+
+	for_each_child(array, &sub, offset) {
+		if (sub.tag != DW_TAG_subrange_type) continue;
+		if (sub.has & HAS_COUNT) count *= sub.count;
+		else if (sub.has & HAS_UPPER_BOUND) count *= sub.upper_bound + 1;
+		else count = 0; // flexible array
+		dims++;
+	}
+	return dims ? count : 0;
+}
+
+static uint32_t type_size(uint32_t type, int depth)
+{
+	dwarf_die_t die;
+
+	if (!type || depth > 16 || !read_die(type, &die)) return 0;
+	if (die.has & HAS_BYTE_SIZE) return die.byte_size;
+	if (is_type_modifier(die.tag)) return type_size(die.type, depth + 1);
+	if (die.tag == DW_TAG_array_type) {
+		return array_count(&die) * type_size(die.type, depth + 1);
+	}
+	if (die.tag == DW_TAG_pointer_type || die.tag == DW_TAG_reference_type
+	  || die.tag == DW_TAG_rvalue_reference_type) return die.unit->addr_size;
+	return 0;
+}
+
+// natural alignment of a type, as the compiler would have laid it out
+static uint32_t type_align(uint32_t type, int depth)
+{
+	dwarf_die_t die, member;
+	uint32_t offset, align, n;
+
+	if (!type || depth > 16 || !read_die(type, &die)) return 1;
+	if (die.alignment) return die.alignment;
+	if (is_type_modifier(die.tag) || die.tag == DW_TAG_array_type) {
+		return type_align(die.type, depth + 1);
+	}
+	if (is_struct(die.tag)) {
+		align = 1;
+		for_each_child(&die, &member, offset) {
+			if (member.tag != DW_TAG_member && member.tag != DW_TAG_inheritance) continue;
+			n = type_align(member.type, depth + 1);
+			if (n > align) align = n;
+		}
+		return align;
+	}
+	n = (die.has & HAS_BYTE_SIZE) ? die.byte_size : die.unit->addr_size;
+	for (align = 1; align * 2 <= n && align < 8; align *= 2) ;
+	return align;
+}
+
+typedef struct {
+	const char *name;
+	uint32_t offset;	// first byte used by the member
+	uint32_t end;		// one past the last byte used
+	uint32_t align;
+	int bitfield;
+	int index;
+} member_t;
+
+static int member_compare(const void *a, const void *b)
+{
+	const member_t *m1 = a, *m2 = b;
+	if (m1->offset != m2->offset) return (m1->offset < m2->offset) ? -1 : 1;
+	return m1->index - m2->index;
+}
+
+// print the holes in one struct, returns bytes saved per instance by reordering
+static uint32_t analyze_struct(const dwarf_die_t *st)
+{
+	dwarf_die_t m;
+	member_t *list = NULL, *p;
+	uint32_t offset, count = 0, max = 0, i, size, align = 1;
+	uint32_t used_end = 0, padding = 0, packed = 0, holes = 0;
+	const char *prev_name = NULL;
+
+	for_each_child(st, &m, offset) {
+		uint32_t start, bits;
+		if (m.tag != DW_TAG_member && m.tag != DW_TAG_inheritance) continue;
+		if (!(m.has & (HAS_MEMBER_LOCATION | HAS_DATA_BIT_OFFSET))) continue;
+		if (count >= max) {
+			max = max ? max * 2 : 32;
+			p = realloc(list, max * sizeof(member_t));
+			if (!p) break;
+			list = p;
+		}
+		p = list + count;
+		p->name = m.name ? m.name : (m.tag == DW_TAG_inheritance) ? "<base class>" : "<anonymous>";
+		p->index = count;
+		p->bitfield = (m.has & HAS_BIT_SIZE) != 0;
+		if (p->bitfield) {
+			if (m.has & HAS_DATA_BIT_OFFSET) {
+				start = m.data_bit_offset;
+			} else {
+				// DWARF 2 & 3 count bits from the MSB of the storage unit
+				bits = ((m.has & HAS_BYTE_SIZE) ? m.byte_size : type_size(m.type, 0)) * 8;
+				start = m.member_location * 8 + bits - m.bit_offset - m.bit_size;
+			}
+			p->offset = start / 8;
+			p->end = (start + m.bit_size + 7) / 8;
+			p->align = 1;
+		} else {
+			p->offset = m.member_location;
+			p->end = p->offset + type_size(m.type, 0);
+			p->align = type_align(m.type, 0);
+		}
+		if (p->align > align) align = p->align;
+		count++;
+	}
+	if (st->alignment) align = st->alignment;
+	size = st->byte_size;
+	if (count == 0) {
+		free(list);
+		return 0;
+	}
+	qsort(list, count, sizeof(member_t), member_compare);
+
+	for (i=0; i < count; i++) {
+		p = list + i;
+		if (p->offset > used_end) {
+			if (holes < 8) {
+				report("      %u byte hole after %s, at offset %u",
+					p->offset - used_end, prev_name, used_end);
+			}
+			holes++;
+			padding += p->offset - used_end;
+		}
+		// adjacent bitfields share bytes, count each byte only once
+		if (p->end > used_end) {
+			packed += p->end - ((p->offset > used_end) ? p->offset : used_end);
+			used_end = p->end;
+		}
+		prev_name = p->name;
+	}
+	if (holes > 8) report("      ... %u more holes", holes - 8);
+	if (size > used_end) {
+		report("      %u bytes tail padding", size - used_end);
+		padding += size - used_end;
+	}
+	free(list);
+	if (padding == 0) {
+		report("      no padding");
+		return 0;
+	}
+	packed = (packed + align - 1) / align * align;
+	if (packed >= size) {
+		report("      %u bytes padding, reordering members would not help", padding);
+		return 0;
+	}
+	report("      %u bytes padding, reordered size would be %u instead of %u",
+		padding, packed, size);
+	return size - packed;
+}
+
+static int ram_object_filter(const elf_symbol_t *sym, void *arg)
+{
+	uint32_t flags;
+
+	if (ELF_ST_TYPE(sym->info) != STT_OBJECT || sym->size == 0) return 0;
+	if (!elf_get_section(sym->shndx, NULL, NULL, NULL, &flags, NULL)) return 0;
+	return (flags & (SHF_WRITE | SHF_ALLOC)) == (SHF_WRITE | SHF_ALLOC);
+}
+
+static int size_compare(const void *a, const void *b)
+{
+	const elf_symbol_t *s1 = a, *s2 = b;
+	if (s1->size != s2->size) return (s1->size > s2->size) ? -1 : 1;
+	if (s1->value != s2->value) return (s1->value < s2->value) ? -1 : 1;
+	return strcmp(s1->name, s2->name);
+}
+
+typedef struct {
+	uint32_t addr;
+	uint32_t die;		// .debug_info offset of the variable's DIE
+} target_t;
+
+static int target_compare(const void *a, const void *b)
+{
+	const target_t *t1 = a, *t2 = b;
+	if (t1->addr != t2->addr) return (t1->addr < t2->addr) ? -1 : 1;
+	return 0;
+}
+
+// walk every DIE, decoding only variables, to find those at the target addresses
+static void find_variables(target_t *targets, int count)
+{
+	const unsigned char *p, *end, *q;
+	const dwarf_abbrev_t *ab;
+	dwarf_die_t die;
+	dwarf_value_t v;
+	target_t key, *t;
+	uint32_t i, j, code, offset;
+	int remaining = count;
+
+	for (i=0; i < unit_count && remaining > 0; i++) {
+		dwarf_unit_t *unit = units + i;
+		unit->abbrevs = parse_abbrev_table(unit);
+		if (!unit->abbrevs) continue;
+		end = info + unit->end;
+		// the unit DIE is always decoded, for DW_AT_str_offsets_base
+		if (!decode_die(unit, unit->die_offset, &die)) continue;
+		p = info + die.next;
+		while (p < end) {
+			offset = p - info;
+			code = read_uleb(&p, end);
+			if (code == 0) continue;
+			ab = find_abbrev(unit->abbrevs, code);
+			if (!ab) break;
+			if (ab->tag == DW_TAG_variable) {
+				if (!decode_die(unit, offset, &die)) break;
+				p = info + die.next;
+				if (!(die.has & HAS_LOCATION)) continue;
+				key.addr = die.location;
+				t = bsearch(&key, targets, count, sizeof(target_t), target_compare);
+				if (t && t->die == 0) {
+					t->die = offset;
+					remaining--;
+				}
+			} else if (ab->fixed_size >= 0) {
+				p += ab->fixed_size;
+			} else {
+				for (j=0; j < ab->attr_count; j++) {
+					q = p;
+					if (!read_form(unit, ab->attr[j].form,
+					  ab->attr[j].implicit_const, &q, end, &v)) break;
+					p = q;
+				}
+				if (j < ab->attr_count) break;
+			}
+		}
+	}
+}
+
+static void free_dwarf(void)
+{
+	uint32_t i, j;
+
+	for (i=0; i < abbrev_table_count; i++) {
+		for (j=0; j < abbrev_tables[i]->count; j++) {
+			free(abbrev_tables[i]->abbrev[j].attr);
+		}
+		free(abbrev_tables[i]->abbrev);
+		free(abbrev_tables[i]);
+	}
+	free(abbrev_tables);
+	abbrev_tables = NULL;
+	abbrev_table_count = 0;
+	free(units);
+	units = NULL;
+	unit_count = 0;
+}
+
+// report padding in the types of the "count" largest variables in RAM
+void padding_report(int count)
+{
+	elf_symbol_t *syms;
+	target_t *targets, key, *t;
+	dwarf_die_t var, type;
+	uint32_t info_flags, abbrev_flags, n, instances, saved, total_saved = 0;
+	const char *section, *type_name;
+	int i, num, depth;
+
+	num = elf_collect_symbols(ram_object_filter, NULL, &syms);
+	if (num < 0) {
+		report("Struct padding: no symbol table");
+		return;
+	}
+	info = elf_section_data(".debug_info", &info_size, &info_flags);
+	abbrev_data = elf_section_data(".debug_abbrev", &abbrev_size, &abbrev_flags);
+	str_data = elf_section_data(".debug_str", &str_size, NULL);
+	line_str_data = elf_section_data(".debug_line_str", &line_str_size, NULL);
+	str_offsets_data = elf_section_data(".debug_str_offsets", &str_offsets_size, NULL);
+	if (!info || !abbrev_data) {
+		report("Struct padding: no DWARF debug info, compile with -g");
+		free(syms);
+		return;
+	}
+	if ((info_flags | abbrev_flags) & SHF_COMPRESSED) {
+		report("Struct padding: compressed debug info is not supported");
+		free(syms);
+		return;
+	}
+
+	qsort(syms, num, sizeof(elf_symbol_t), size_compare);
+	if (num > count) num = count;
+	targets = malloc((num ? num : 1) * sizeof(target_t));
+	if (!targets || read_unit_headers() < 0) die("unable to allocate memory\n");
+	for (i=0; i < num; i++) {
+		targets[i].addr = syms[i].value;
+		targets[i].die = 0;
+	}
+	qsort(targets, num, sizeof(target_t), target_compare);
+	find_variables(targets, num);
+
+	report("Struct padding in the %d largest RAM variables:", num);
+	for (i=0; i < num; i++) {
+		elf_get_section(syms[i].shndx, &section, NULL, NULL, NULL, NULL);
+		report("  %-28s %7u bytes in %s", syms[i].name, syms[i].size, section);
+		key.addr = syms[i].value;
+		t = bsearch(&key, targets, num, sizeof(target_t), target_compare);
+		if (!t || !t->die || !read_die(t->die, &var)) {
+			report("      no debug info");
+			continue;
+		}
+		// definitions may refer to a declaration for the type
+		for (depth=0; !var.type && depth < 4; depth++) {
+			uint32_t ref = var.specification ? var.specification : var.abstract_origin;
+			if (!ref || !read_die(ref, &var)) break;
+		}
+		type_name = NULL;
+		n = var.type;
+		for (depth=0; n && depth < 16; depth++) {
+			if (!read_die(n, &type)) break;
+			if (!is_type_modifier(type.tag) && type.tag != DW_TAG_array_type) break;
+			if (type.tag == DW_TAG_typedef && !type_name) type_name = type.name;
+			n = type.type;
+		}
+		if (!n || depth >= 16 || !is_struct(type.tag)) {
+			report("      not a struct or class");
+			continue;
+		}
+		if (type.tag == DW_TAG_union_type) {
+			report("      union, not analyzed");
+			continue;
+		}
+		if (type.name) type_name = type.name;
+		if (!type_name) type_name = "<anonymous>";
+		if (!(type.has & HAS_BYTE_SIZE) || type.byte_size == 0) {
+			report("      %s is incomplete", type_name);
+			continue;
+		}
+		instances = syms[i].size / type.byte_size;
+		if (instances > 1) {
+			report("      %s %s, %u bytes each, %u instances",
+				(type.tag == DW_TAG_class_type) ? "class" : "struct",
+				type_name, type.byte_size, instances);
+		} else {
+			report("      %s %s, %u bytes",
+				(type.tag == DW_TAG_class_type) ? "class" : "struct",
+				type_name, type.byte_size);
+		}
+		saved = analyze_struct(&type) * instances;
+		if (saved > 0) report("      reordering would save %u bytes", saved);
+		total_saved += saved;
+	}
+	report("Total bytes reordering would save: %u", total_saved);
+
+	free(targets);
+	free(syms);
+	free_dwarf();
+}
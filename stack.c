@@ -0,0 +1,478 @@
+// Worst case stack depth, from a call graph of the Thumb-2 code
+//
+// Frame sizes come from GCC -fstack-usage (.su) files when given,
+// otherwise they are estimated from each function's prologue.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "minimal_elf.h"
+#include "teensy_size.h"
+#include "thumb.h"
+
+#define FRAME_FROM_SU		0x01
+#define FRAME_DYNAMIC		0x02
+#define INDIRECT_CALLS		0x04
+#define RECURSIVE		0x08
+
+typedef struct {
+	uint32_t frame;
+	uint32_t depth;		// worst case of this function plus callees
+	int next;		// callee on the worst case path, or -1
+	int first_edge;
+	int edge_count;
+	uint8_t state;		// 0=not visited, 1=in progress, 2=done
+	uint8_t flags;
+} stack_func_t;
+
+typedef struct {
+	int caller;
+	int callee;
+	int kind;
+} edge_t;
+
+typedef struct {
+	char *key;
+	int index;
+} func_key_t;
+
+static thumb_func_t *funcs;
+static stack_func_t *info;
+static int func_count;
+static edge_t *edges;
+static func_key_t *keys;
+static int key_count;
+static int su_entries;
+
+
+static void append(char *out, size_t outsize, const char *str, size_t len)
+{
+	size_t n = strlen(out);
+	if (n + len + 1 > outsize) return;
+	memcpy(out + n, str, len);
+	out[n + len] = 0;
+}
+
+// skip one <length><name> from a mangled name
+static const char * skip_source_name(const char *p, const char **name, size_t *len)
+{
+	size_t n = 0;
+	while (*p >= '0' && *p <= '9') n = n * 10 + (*p++ - '0');
+	if (strlen(p) < n) return NULL;
+	*name = p;
+	*len = n;
+	return p + n;
+}
+
+// skip template arguments "I...E" in a mangled name
+static const char * skip_template_args(const char *p)
+{
+	const char *name;
+	size_t len;
+	int depth = 0;
+
+	do {
+		if (*p == 0) return NULL;
+		if (*p >= '0' && *p <= '9') {
+			p = skip_source_name(p, &name, &len);
+			if (!p) return NULL;
+			continue;
+		}
+		if (*p == 'L') {
+			// literal, type then value
+			p += 2;
+			while (*p && *p != 'E') p++;
+			if (*p++ != 'E') return NULL;
+			continue;
+		}
+		if ((*p == 'S' || *p == 'T') && (p[1] == '_' || (p[1] >= '0' && p[1] <= '9')
+		  || (p[1] >= 'A' && p[1] <= 'Z'))) {
+			p++;
+			while (*p && *p != '_') p++;
+			if (*p++ != '_') return NULL;
+			continue;
+		}
+		if (*p == 'I' || *p == 'N' || *p == 'X') depth++;
+		else if (*p == 'E') depth--;
+		p++;
+	} while (depth > 0);
+	return p;
+}
+
+// reduce a symbol name to a lookup key, "_ZN2ns3Foo3barEi" becomes
+// "ns::Foo::bar" and C names stay the same.  Compiler generated clone
+// suffixes like ".constprop.0" are removed.  Returns 0 if the name uses
+// mangling features not handled here.
+static int symbol_key(const char *sym, char *out, size_t outsize)
+{
+	char buf[1024];
+	const char *p, *name, *last = NULL;
+	size_t len, last_len = 0;
+	int nested;
+
+	snprintf(buf, sizeof(buf), "%s", sym);
+	buf[strcspn(buf, ".")] = 0;
+	out[0] = 0;
+	if (strncmp(buf, "_Z", 2) != 0) {
+		append(out, outsize, buf, strlen(buf));
+		return 1;
+	}
+	p = buf + 2;
+	if (*p == 'L') p++;	// internal linkage, static functions
+	nested = (*p == 'N');
+	if (nested) {
+		p++;
+		while (*p == 'r' || *p == 'V' || *p == 'K' || *p == 'R' || *p == 'O') p++;
+	} else if (p[0] == 'S' && p[1] == 't') {
+		append(out, outsize, "std", 3);
+		p += 2;
+	}
+	do {
+		if (*p == 'L' && p[1] >= '0' && p[1] <= '9') p++;
+		if (*p >= '0' && *p <= '9') {
+			p = skip_source_name(p, &name, &len);
+			if (!p) return 0;
+			if (strncmp(name, "_GLOBAL__N", 10) == 0) continue;
+			if (out[0]) append(out, outsize, "::", 2);
+			append(out, outsize, name, len);
+			last = name;
+			last_len = len;
+		} else if (p[0] == 'S' && p[1] == 't') {
+			append(out, outsize, "std", 3);
+			p += 2;
+			continue;
+		} else if (p[0] == 'C' && last && p[1] >= '1' && p[1] <= '5') {
+			append(out, outsize, "::", 2);
+			append(out, outsize, last, last_len);
+			p += 2;
+		} else if (p[0] == 'D' && last && p[1] >= '0' && p[1] <= '5') {
+			append(out, outsize, "::~", 3);
+			append(out, outsize, last, last_len);
+			p += 2;
+		} else {
+			return 0;
+		}
+		if (*p == 'I') {
+			p = skip_template_args(p);
+			if (!p) return 0;
+		}
+	} while (nested && *p && *p != 'E');
+	return out[0] != 0;
+}
+
+// reduce a function name from a .su file to a lookup key, like
+// "void ns::Foo<int>::bar(int) const" to "ns::Foo::bar"
+static void su_key(const char *name, char *out, size_t outsize)
+{
+	char buf[1024], *p, *q;
+	int depth = 0;
+
+	snprintf(buf, sizeof(buf), "%s", name);
+	// older GCC writes "(anonymous namespace)::", newer uses "{anonymous}::"
+	while ((p = strstr(buf, "(anonymous namespace)::")) != NULL) {
+		memmove(p, p + 23, strlen(p + 23) + 1);
+	}
+	while ((p = strstr(buf, "{anonymous}::")) != NULL) {
+		memmove(p, p + 13, strlen(p + 13) + 1);
+	}
+	// remove template arguments and everything from the parameter list
+	for (p = q = buf; *p; p++) {
+		if (*p == '<') depth++;
+		else if (*p == '>' && depth > 0) depth--;
+		else if (*p == '(' && depth == 0) break;
+		else if (depth == 0) *q++ = *p;
+	}
+	*q = 0;
+	// remove the return type
+	p = strrchr(buf, ' ');
+	p = p ? p + 1 : buf;
+	while (*p == '*' || *p == '&') p++;
+	if (!strchr(name, '(')) p[strcspn(p, ".")] = 0;
+	snprintf(out, outsize, "%s", p);
+}
+
+static int key_compare(const void *a, const void *b)
+{
+	const func_key_t *k1 = a, *k2 = b;
+	int n = strcmp(k1->key, k2->key);
+	if (n) return n;
+	return k1->index - k2->index;
+}
+
+// first key equal to or greater than find
+static func_key_t * bsearch_first(const func_key_t *find)
+{
+	int lo = 0, hi = key_count;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (key_compare(keys + mid, find) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	return keys + lo;
+}
+
+static void read_su_file(const char *filename)
+{
+	char line[2048], key[1024];
+	func_key_t find, *k;
+	FILE *f;
+
+	f = fopen(filename, "r");
+	if (!f) return;
+	while (fgets(line, sizeof(line), f)) {
+		char *tab, *name = NULL, *p;
+		unsigned long frame;
+
+		// file:line:column:function<TAB>bytes<TAB>qualifiers
+		tab = strchr(line, '\t');
+		if (!tab) continue;
+		*tab = 0;
+		for (p = line; (p = strchr(p, ':')) != NULL; p++) {
+			char *q = p + 1;
+			if (*q < '0' || *q > '9') continue;
+			while (*q >= '0' && *q <= '9') q++;
+			if (*q++ != ':') continue;
+			if (*q < '0' || *q > '9') continue;
+			while (*q >= '0' && *q <= '9') q++;
+			if (*q++ != ':') continue;
+			name = q;
+			break;
+		}
+		if (!name) continue;
+		frame = strtoul(tab + 1, &p, 10);
+		su_key(name, key, sizeof(key));
+		su_entries++;
+
+		// every function with a matching key gets this frame size, so
+		// overloaded and duplicate static functions use the largest
+		find.key = key;
+		find.index = -1;
+		k = bsearch_first(&find);
+		for ( ; k < keys + key_count && strcmp(k->key, key) == 0; k++) {
+			stack_func_t *fi = info + k->index;
+			if (!(fi->flags & FRAME_FROM_SU) || frame > fi->frame) {
+				fi->frame = frame;
+			}
+			fi->flags |= FRAME_FROM_SU;
+			if (strstr(p, "dynamic")) fi->flags |= FRAME_DYNAMIC;
+		}
+	}
+	fclose(f);
+}
+
+// read a .su file, or all .su files within a directory
+static void read_su_path(const char *path, int depth)
+{
+	struct stat st;
+	struct dirent *ent;
+	char name[4096];
+	DIR *dir;
+	size_t len;
+
+	if (stat(path, &st) != 0) {
+		report("  Unable to read %s", path);
+		return;
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		read_su_file(path);
+		return;
+	}
+	if (depth > 8) return;
+	dir = opendir(path);
+	if (!dir) return;
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.') continue;
+		snprintf(name, sizeof(name), "%s/%s", path, ent->d_name);
+		len = strlen(ent->d_name);
+		if (len > 3 && strcmp(ent->d_name + len - 3, ".su") == 0) {
+			read_su_file(name);
+		} else if (stat(name, &st) == 0 && S_ISDIR(st.st_mode)) {
+			read_su_path(name, depth + 1);
+		}
+	}
+	closedir(dir);
+}
+
+static int edge_compare(const void *a, const void *b)
+{
+	const edge_t *e1 = a, *e2 = b;
+	if (e1->caller != e2->caller) return e1->caller - e2->caller;
+	if (e1->callee != e2->callee) return e1->callee - e2->callee;
+	return e1->kind - e2->kind;
+}
+
+// build the call graph, returns the number of edges
+static int build_call_graph(void)
+{
+	thumb_branch_t *branches;
+	int i, n, num, caller, callee, count = 0;
+
+	num = thumb_branches(&branches);
+	if (num < 0) return -1;
+	edges = malloc((num ? num : 1) * sizeof(edge_t));
+	if (!edges) die("unable to allocate memory\n");
+	for (i=0; i < num; i++) {
+		caller = thumb_find_function(funcs, func_count, branches[i].site);
+		if (caller < 0) continue;
+		if (branches[i].kind == BRANCH_INDIRECT) {
+			info[caller].flags |= INDIRECT_CALLS;
+			continue;
+		}
+		if (branches[i].kind == BRANCH_ADDRESS) continue;
+		callee = thumb_function_at(funcs, func_count, branches[i].target);
+		if (callee < 0) continue;  // branch within a function
+		if (callee == caller) {
+			// branching to its own start is a loop, unless it's a call
+			if (branches[i].kind == BRANCH_CALL) info[caller].flags |= RECURSIVE;
+			continue;
+		}
+		edges[count].caller = caller;
+		edges[count].callee = callee;
+		edges[count].kind = branches[i].kind;
+		count++;
+	}
+	free(branches);
+
+	qsort(edges, count, sizeof(edge_t), edge_compare);
+	for (i=0, n=0; i < count; i++) {
+		if (n > 0 && edge_compare(edges + n - 1, edges + i) == 0) continue;
+		edges[n++] = edges[i];
+	}
+	for (i=0; i < func_count; i++) info[i].first_edge = -1;
+	for (i=0; i < n; i++) {
+		stack_func_t *fi = info + edges[i].caller;
+		if (fi->first_edge < 0) fi->first_edge = i;
+		fi->edge_count++;
+	}
+	return n;
+}
+
+// worst case stack usage of a function and everything it calls.  A tail
+// call (B.W) happens after the caller's frame is removed.
+static uint32_t stack_depth(int f)
+{
+	stack_func_t *fi = info + f;
+	uint32_t depth, best = fi->frame;
+	int i, e;
+
+	if (fi->state == 2) return fi->depth;
+	fi->state = 1;
+	fi->next = -1;
+	for (i=0; i < fi->edge_count; i++) {
+		e = fi->first_edge + i;
+		int c = edges[e].callee;
+		if (info[c].state == 1) {
+			fi->flags |= RECURSIVE;
+			info[c].flags |= RECURSIVE;
+			continue;
+		}
+		depth = stack_depth(c);
+		if (edges[e].kind == BRANCH_CALL) depth += fi->frame;
+		if (depth > best) {
+			best = depth;
+			fi->next = c;
+		}
+	}
+	fi->depth = best;
+	fi->state = 2;
+	return best;
+}
+
+static void free_stack(void)
+{
+	int i;
+
+	for (i=0; i < key_count; i++) free(keys[i].key);
+	free(keys);
+	keys = NULL;
+	key_count = 0;
+	free(edges);
+	edges = NULL;
+	free(info);
+	info = NULL;
+	free(funcs);
+	funcs = NULL;
+	func_count = 0;
+	su_entries = 0;
+}
+
+// report the worst case stack depth, compared to the memory available
+void stack_report(const char **su_paths, int su_count, int32_t available)
+{
+	char key[1024], flags[80];
+	int i, f, worst, num_su = 0, num_recursive = 0, num_indirect = 0;
+
+	if (elf_get_architecture() != 40) {
+		report("Stack usage: only supported for ARM");
+		return;
+	}
+	func_count = thumb_functions(&funcs);
+	if (func_count <= 0) {
+		report("Stack usage: no functions in symbol table");
+		free(funcs);
+		return;
+	}
+	info = calloc(func_count, sizeof(stack_func_t));
+	keys = malloc(func_count * sizeof(func_key_t));
+	if (!info || !keys) die("unable to allocate memory\n");
+
+	if (su_count > 0) {
+		for (i=0; i < func_count; i++) {
+			if (!symbol_key(funcs[i].name, key, sizeof(key))) continue;
+			keys[key_count].key = strdup(key);
+			keys[key_count].index = i;
+			if (keys[key_count].key) key_count++;
+		}
+		qsort(keys, key_count, sizeof(func_key_t), key_compare);
+		for (i=0; i < su_count; i++) read_su_path(su_paths[i], 0);
+	}
+	for (i=0; i < func_count; i++) {
+		if (info[i].flags & FRAME_FROM_SU) num_su++;
+		else info[i].frame = thumb_frame_estimate(funcs + i);
+	}
+	if (build_call_graph() < 0) {
+		report("Stack usage: unable to read code");
+		free_stack();
+		return;
+	}
+
+	worst = 0;
+	for (i=0; i < func_count; i++) {
+		if (stack_depth(i) > info[worst].depth) worst = i;
+	}
+	for (i=0; i < func_count; i++) {
+		if (info[i].flags & RECURSIVE) num_recursive++;
+		if (info[i].flags & INDIRECT_CALLS) num_indirect++;
+	}
+
+	report("Stack usage, worst case call chain needs %u bytes:", info[worst].depth);
+	report("    depth  frame  function");
+	for (f = worst, i = 0; f >= 0 && i < 200; f = info[f].next, i++) {
+		flags[0] = 0;
+		if (!(info[f].flags & FRAME_FROM_SU)) strcat(flags, " (estimated)");
+		if (info[f].flags & FRAME_DYNAMIC) strcat(flags, " (dynamic)");
+		if (info[f].flags & RECURSIVE) strcat(flags, " (recursive)");
+		if (info[f].flags & INDIRECT_CALLS) strcat(flags, " (indirect calls)");
+		report("  %7u %6u  %s%s", info[f].depth, info[f].frame, funcs[f].name, flags);
+	}
+	report("  Free for local variables: %d bytes%s", available,
+		((int32_t)info[worst].depth > available) ? ", stack may overflow!" : "");
+	report("  Frame sizes: %d from %d .su entries, %d estimated from code",
+		num_su, su_entries, func_count - num_su);
+	if (num_recursive > 0) {
+		report("  Recursive functions, repeated calls not counted: %d", num_recursive);
+		for (i=0; i < func_count; i++) {
+			if (info[i].flags & RECURSIVE) report("    %s", funcs[i].name);
+		}
+	}
+	if (num_indirect > 0) {
+		report("  Functions with indirect calls, not followed: %d", num_indirect);
+	}
+	report("  Interrupts may use more stack at any time");
+	free_stack();
+}
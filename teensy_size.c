@@ -2,19 +2,46 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <limits.h>
 #include <string.h>
+#include <errno.h>
+#ifdef __linux__
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
 
 #include "minimal_elf.h"
+#include "teensy_size.h"
 
-void die(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
 void line(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
 const char * get_output();
 const char *prefix = NULL;
+size_t output_len = 0;
+int32_t free_for_stack = 0;
+
+// optional analysis reports
+int padding = 0;
+int stack = 0;
+int veneers = 0;
+int unreferenced = 0;
+int boot_cost = 0;
+double boot_copy_rate = 0, boot_zero_rate = 0;
+boot_cost_t boot_baseline;
+int boot_baseline_model = 0;
+const char *su_paths[64];
+int su_count = 0;
+#define WATCH_DEBOUNCE_MS 50
+#define WATCH_RETRY_MS 250
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
 
 
 
 unsigned char *filedata = NULL;
+size_t filedata_size = 0;
 FILE *fp = NULL;
+FILE *report_out = NULL;
 
 struct {
 	const char *name;
@@ -79,88 +106,60 @@ uint32_t ram_size(int model)
 
 
 
-void usage()
+// read and parse an ELF file, reusing the file buffer from any previous
+// call.  Returns NULL on success, or an error message.
+const char * load_elf(const char *filename)
 {
-	die("usage: teensy_size [--json] <file.elf>\n");
-}
+	static char err[600];
+	size_t filesize;
 
-int main(int argc, char **argv)
-{
-	int retval = 0;
-	int json = 0;
-	unsigned int arduino_cli = 0;
-	unsigned int arduino_ide = 0;
-	memset(json_sections, 0, sizeof(json_sections));
-	FILE *fout = stdout;
-
-	// parse command line
-	if (argc < 2) usage();
-	const char *filename = argv[1];
-	if (strcmp(filename, "--json") == 0 && argc > 2) {
-		json = 1;
-		filename = argv[2];
+	fp = fopen(filename, "rb");
+	if (!fp) {
+		snprintf(err, sizeof(err), "Unable to open for reading %s\n", filename);
+		return err;
 	}
-
-	// detect Arduino version info
-	const char *arduino = getenv("ARDUINO_USER_AGENT");
-	if (arduino) {
-		//printf("ARDUINO_USER_AGENT = %s\n", arduino);
-		int n1=0, n2=0, n3=0;
-		const char *cli = strstr(arduino, "arduino-cli/");
-		if (cli && sscanf(cli+12, "%d.%d.%d", &n1, &n2, &n3) == 3 &&
-		  n1 > 0 && n1 < 256 && n2 > 0 && n2 < 256 && n3 > 0 && n3 < 256) {
-			//printf("CLI: %d %d %d\n", n1, n2, n3);
-			arduino_cli = (n1 << 16) | (n2 << 8) | n3;
-		}
-		n1=0, n2=0, n3=0;
-		const char *ide = strstr(arduino, "arduino-ide/");
-		if (ide && sscanf(ide+12, "%d.%d.%d", &n1, &n2, &n3) == 3 &&
-		  n1 > 0 && n1 < 256 && n2 > 0 && n2 < 256 && n3 > 0 && n3 < 256) {
-			//printf("CLI: %d %d %d\n", n1, n2, n3);
-			arduino_ide = (n1 << 16) | (n2 << 8) | n3;
-		}
+	fseek(fp, 0, SEEK_END);
+	filesize = ftell(fp);
+	if (filesize < 52) {
+		fclose(fp);
+		fp = NULL;
+		snprintf(err, sizeof(err), "Unable to parse %s, file too short\n", filename);
+		return err;
 	}
-
-	// decide how to print output
-	if (json) {
-		fout = stdout;
-	} else {
-		if (arduino_cli > 0 && arduino_ide == 0) {
-			fout = stdout;
-		}
-		if (arduino_ide > 0x20000) {
-			// Arduino 2.x.x only shows output if sterrr
-			fout = stderr;
-		}
-		if (arduino_cli == 0 && arduino_ide == 0) {
-			// Arduino 1.8.x discards info unless stderr
-			fout = stderr;
-			prefix = "teensy_size: "; // trick to print in white text
-		}
-		if (getenv("TEENSY_SIZE_FORCE_STDOUT") != NULL) {
-			// https://github.com/PaulStoffregen/teensy_size/issues/7
-			fout = stdout;
-			prefix = "";
+	if (filesize > filedata_size || !filedata) {
+		free(filedata);
+		filedata_size = 0;
+		filedata = malloc(filesize ? filesize : 1);
+		if (!filedata) {
+			fclose(fp);
+			fp = NULL;
+			snprintf(err, sizeof(err), "unable to allocate %ld bytes\n", (long)filesize);
+			return err;
 		}
+		filedata_size = filesize;
 	}
-
-	// read and parse ELF data
-	fp = fopen(filename, "rb");
-	if (!fp) die("Unable to open for reading %s\n", filename);
-	fseek(fp, 0, SEEK_END);
-	size_t filesize = ftell(fp);
-	filedata = malloc(filesize);
-	if (!filedata) die("unable to allocate %ld bytes\n", (long)filesize);
 	rewind(fp);
-	if (fread(filedata, 1, filesize, fp) != filesize)  die("Unable to read %s\n", filename);
+	if (fread(filedata, 1, filesize, fp) != filesize) {
+		fclose(fp);
+		fp = NULL;
+		snprintf(err, sizeof(err), "Unable to read %s\n", filename);
+		return err;
+	}
 	fclose(fp);
 	fp = NULL;
-	int r = parse_elf(filedata);
-	if (r != 0) die("Unable to parse %s, err = %d\n", filename, r);
-
+	int r = parse_elf(filedata, filesize);
+	if (r != 0) {
+		snprintf(err, sizeof(err), "Unable to parse %s, err = %d\n", filename, r);
+		return err;
+	}
+	return NULL;
+}
 
-	int model = elf_teensy_model_id(filedata);
-	if (!model) die("Can't determine Teensy model from %s\n", filename);
+// compute memory usage of the loaded ELF file, adding the report to the
+// output buffer.  Returns 0 if everything fits, -1 if memory is exceeded.
+int memory_usage(int model)
+{
+	int retval = 0;
 
 	//print_elf_info();
 	//printf("Teensy Model is %02X (%s)\n", model, model_name(model));
@@ -199,6 +198,7 @@ int main(int argc, char **argv)
 		int32_t free_for_malloc = (int32_t)512*1024 - (int32_t)ram2;
 
 		if ((free_flash < 0) || (free_for_local <= 0) || (free_for_malloc < 0)) retval = -1;
+		free_for_stack = free_for_local;
 
 		line("  FLASH: code:%u, data:%u, headers:%u   free for files:%d",
 			flash_code, flash_data, flash_headers, free_flash);
@@ -237,6 +237,7 @@ int main(int argc, char **argv)
 		uint32_t flash = text + data + fini + arm_exidx;
 		uint32_t ram = data + bss + noinit + usbdesc + dmabuffers + usbbuffers;
 		if (flash > flash_size(model) || ram > ram_size(model)) retval = -1;
+		free_for_stack = ram_size(model) - ram;
 		line("  Program uses %u bytes of flash storage. Maximum is %u bytes.",
 			flash, flash_size(model));
 		json_sections[0].name = "FLASH";
@@ -257,6 +258,7 @@ int main(int argc, char **argv)
 		uint32_t flash = text + data;
 		uint32_t ram = data + bss + noinit;
 		if (flash > flash_size(model) || ram > ram_size(model)) retval = -1;
+		free_for_stack = ram_size(model) - ram;
 		line("  Program uses %u bytes of flash storage. Maximum is %u bytes.",
 			flash, flash_size(model));
 		json_sections[0].name = "FLASH";
@@ -268,6 +270,299 @@ int main(int argc, char **argv)
 		json_sections[1].size = ram;
 		json_sections[1].max_size = ram_size(model);
 	}
+	return retval;
+}
+
+// print the optional reports requested on the command line
+void analysis_reports(int model)
+{
+	if (padding) padding_report(padding);
+	if (stack) stack_report(su_paths, su_count, free_for_stack);
+	if (veneers) veneers_report();
+	if (unreferenced) unreferenced_report();
+	if (boot_cost) {
+		boot_cost_t bc;
+		boot_cost_measure(model, boot_copy_rate, boot_zero_rate, &bc);
+		if (boot_baseline_model && boot_baseline_model != model) {
+			// different sections and rates, a comparison would be meaningless
+			boot_cost_report(&bc, NULL);
+			report("  Baseline is for %s, not compared", model_name(boot_baseline_model));
+		} else {
+			boot_cost_report(&bc, &boot_baseline);
+		}
+	}
+}
+
+#ifdef __linux__
+// check a buffer of inotify events.  Returns 1 if the ELF file changed,
+// or 2 if the watched directory was deleted or moved (a clean build).
+static int watch_events(const char *events, int n, int wd, const char *basename)
+{
+	int i, result = 0;
+
+	for (i=0; i < n; ) {
+		const struct inotify_event *ev = (const struct inotify_event *)(events + i);
+		if (ev->wd == wd) {
+			if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+				result |= 2;
+			} else if (ev->len > 0 && strcmp(ev->name, basename) == 0) {
+				result |= 1;
+			}
+		}
+		i += sizeof(struct inotify_event) + ev->len;
+	}
+	return result;
+}
+
+// watch the directory, waiting for it to be created if necessary
+static int watch_dir(int fd, const char *dir, FILE *fout)
+{
+	struct timespec retry = {0, WATCH_RETRY_MS * 1000000L};
+	int wd, waiting = 0;
+
+	while ((wd = inotify_add_watch(fd, dir, WATCH_EVENTS)) < 0) {
+		if (errno != ENOENT) die("Unable to watch %s, %s\n", dir, strerror(errno));
+		if (!waiting) {
+			fprintf(fout, "%sWaiting for %s to be created\n", prefix ? prefix : "", dir);
+			fflush(fout);
+			waiting = 1;
+		}
+		nanosleep(&retry, NULL);
+	}
+	return wd;
+}
+
+// print the memory usage again each time the ELF file is rewritten.
+// The file's directory is watched, because linkers often replace the
+// file by creating a new one or renaming a temporary file.
+int watch_elf(const char *filename, FILE *fout)
+{
+	char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	uint32_t previous[4];
+	int have_previous = 0;
+	struct timespec t1, t2;
+	struct pollfd pfd;
+	int fd, wd, i, n, changed, lost;
+
+	const char *slash = strrchr(filename, '/');
+	const char *basename = slash ? slash + 1 : filename;
+	char dir[4096];
+	if (slash) {
+		snprintf(dir, sizeof(dir), "%.*s", (int)(slash - filename + 1), filename);
+	} else {
+		strcpy(dir, ".");
+	}
+	fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0) die("Unable to use inotify, %s\n", strerror(errno));
+	wd = watch_dir(fd, dir, fout);
+	report_out = fout;
+	changed = 1; // initial report, if the file already exists
+	while (1) {
+		if (changed) {
+			// a linker may write the file in several steps, so
+			// wait until it's been quiet for WATCH_DEBOUNCE_MS
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			lost = 0;
+			while (poll(&pfd, 1, WATCH_DEBOUNCE_MS) > 0) {
+				n = read(fd, events, sizeof(events));
+				if (n <= 0) break;
+				lost |= watch_events(events, n, wd, basename) & 2;
+			}
+			if (lost) {
+				// directory removed while the file was being written
+				inotify_rm_watch(fd, wd);
+				wd = watch_dir(fd, dir, fout);
+				continue;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			output_len = 0;
+			memset(json_sections, 0, sizeof(json_sections));
+			const char *err = load_elf(filename);
+			int model = err ? 0 : elf_teensy_model_id(filedata);
+			if (err) {
+				fprintf(fout, "%s%s", prefix ? prefix : "", err);
+			} else if (!model) {
+				fprintf(fout, "%sCan't determine Teensy model from %s\n",
+					prefix ? prefix : "", filename);
+			} else {
+				int retval = memory_usage(model);
+				if (have_previous) {
+					char buf[200];
+					int len = 0;
+					for (i=0; i < 4 && json_sections[i].name; i++) {
+						int32_t delta = json_sections[i].size - previous[i];
+						len += snprintf(buf + len, sizeof(buf) - len, "%s %s:%+d",
+							(i ? "," : ""), json_sections[i].name, delta);
+					}
+					line("  change since previous build:%s", buf);
+				}
+				for (i=0; i < 4; i++) previous[i] = json_sections[i].size;
+				have_previous = 1;
+				clock_gettime(CLOCK_MONOTONIC, &t2);
+				line("  analyzed in %.2f ms", (t2.tv_sec - t1.tv_sec) * 1000.0
+					+ (t2.tv_nsec - t1.tv_nsec) / 1000000.0);
+				fprintf(fout, "%s", get_output());
+				if (retval != 0) {
+					fprintf(fout,"Error program exceeds memory space\n");
+				}
+				analysis_reports(model);
+			}
+			fprintf(fout, "\n");
+			fflush(fout);
+			changed = 0;
+		}
+		// sleep until the directory has activity
+		n = read(fd, events, sizeof(events));
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) die("Error reading inotify events\n");
+		changed = watch_events(events, n, wd, basename);
+		if (changed & 2) {
+			// the directory was deleted or moved, watch it again when
+			// it's recreated, and check the file in case it's already there
+			inotify_rm_watch(fd, wd);
+			wd = watch_dir(fd, dir, fout);
+		}
+	}
+	return 0;
+}
+#else
+int watch_elf(const char *filename, FILE *fout)
+{
+	die("--watch is only supported on Linux\n");
+	return 0;
+}
+#endif
+
+void usage()
+{
+	die("usage: teensy_size [--json] [--watch] [--padding[=N]] [--stack [--su=path]...]\n"
+	    "                   [--veneers] [--unreferenced] [--boot-cost [--boot-rates=COPY,ZERO]\n"
+	    "                   [--baseline=old.elf]] [--jobs=N] <file.elf>\n");
+}
+
+int main(int argc, char **argv)
+{
+	int retval = 0;
+	int json = 0;
+	int watch = 0;
+	const char *baseline = NULL;
+	int boot_rates = 0;
+	unsigned int arduino_cli = 0;
+	unsigned int arduino_ide = 0;
+	memset(json_sections, 0, sizeof(json_sections));
+	FILE *fout = stdout;
+
+	// parse command line
+	const char *filename = NULL;
+	for (int i=1; i < argc; i++) {
+		const char *arg = argv[i];
+		if (strcmp(arg, "--json") == 0) {
+			json = 1;
+		} else if (strcmp(arg, "--watch") == 0) {
+			watch = 1;
+		} else if (strcmp(arg, "--padding") == 0) {
+			padding = 10;
+		} else if (strncmp(arg, "--padding=", 10) == 0) {
+			padding = atoi(arg + 10);
+			if (padding <= 0) usage();
+		} else if (strcmp(arg, "--stack") == 0) {
+			stack = 1;
+		} else if (strcmp(arg, "--veneers") == 0) {
+			veneers = 1;
+		} else if (strcmp(arg, "--unreferenced") == 0) {
+			unreferenced = 1;
+		} else if (strcmp(arg, "--boot-cost") == 0) {
+			boot_cost = 1;
+		} else if (strncmp(arg, "--boot-rates=", 13) == 0) {
+			if (sscanf(arg + 13, "%lf,%lf", &boot_copy_rate, &boot_zero_rate) != 2
+			  || boot_copy_rate <= 0 || boot_zero_rate <= 0) usage();
+			boot_rates = 1;
+		} else if (strncmp(arg, "--baseline=", 11) == 0) {
+			baseline = arg + 11;
+		} else if (strncmp(arg, "--jobs=", 7) == 0) {
+			char *end;
+			long jobs = strtol(arg + 7, &end, 10);
+			if (end == arg + 7 || *end || jobs < 0 || jobs > INT_MAX) usage();
+			elf_set_jobs(jobs);
+		} else if (strncmp(arg, "--su=", 5) == 0) {
+			if (su_count >= 64) usage();
+			su_paths[su_count++] = arg + 5;
+		} else if (arg[0] == '-' && arg[1] == '-') {
+			usage();
+		} else if (!filename) {
+			filename = arg;
+		} else {
+			usage();
+		}
+	}
+	if (!filename || (watch && json)) usage();
+	if ((baseline || boot_rates) && !boot_cost) usage();
+
+	// detect Arduino version info
+	const char *arduino = getenv("ARDUINO_USER_AGENT");
+	if (arduino) {
+		//printf("ARDUINO_USER_AGENT = %s\n", arduino);
+		int n1=0, n2=0, n3=0;
+		const char *cli = strstr(arduino, "arduino-cli/");
+		if (cli && sscanf(cli+12, "%d.%d.%d", &n1, &n2, &n3) == 3 &&
+		  n1 > 0 && n1 < 256 && n2 > 0 && n2 < 256 && n3 > 0 && n3 < 256) {
+			//printf("CLI: %d %d %d\n", n1, n2, n3);
+			arduino_cli = (n1 << 16) | (n2 << 8) | n3;
+		}
+		n1=0, n2=0, n3=0;
+		const char *ide = strstr(arduino, "arduino-ide/");
+		if (ide && sscanf(ide+12, "%d.%d.%d", &n1, &n2, &n3) == 3 &&
+		  n1 > 0 && n1 < 256 && n2 > 0 && n2 < 256 && n3 > 0 && n3 < 256) {
+			//printf("CLI: %d %d %d\n", n1, n2, n3);
+			arduino_ide = (n1 << 16) | (n2 << 8) | n3;
+		}
+	}
+
+	// decide how to print output
+	if (json) {
+		fout = stdout;
+	} else {
+		if (arduino_cli > 0 && arduino_ide == 0) {
+			fout = stdout;
+		}
+		if (arduino_ide > 0x20000) {
+			// Arduino 2.x.x only shows output if sterrr
+			fout = stderr;
+		}
+		if (arduino_cli == 0 && arduino_ide == 0) {
+			// Arduino 1.8.x discards info unless stderr
+			fout = stderr;
+			prefix = "teensy_size: "; // trick to print in white text
+		}
+		if (getenv("TEENSY_SIZE_FORCE_STDOUT") != NULL) {
+			// https://github.com/PaulStoffregen/teensy_size/issues/7
+			fout = stdout;
+			prefix = "";
+		}
+	}
+
+	// the baseline is measured first, since only one ELF file is parsed at a time
+	memset(&boot_baseline, 0, sizeof(boot_baseline));
+	if (baseline) {
+		const char *err = load_elf(baseline);
+		if (err) die("%s", err);
+		int model = elf_teensy_model_id(filedata);
+		if (!model) die("Can't determine Teensy model from %s\n", baseline);
+		boot_cost_measure(model, boot_copy_rate, boot_zero_rate, &boot_baseline);
+		boot_baseline_model = model;
+	}
+
+	if (watch) return watch_elf(filename, fout);
+
+	// read and parse ELF data
+	const char *err = load_elf(filename);
+	if (err) die("%s", err);
+
+	int model = elf_teensy_model_id(filedata);
+	if (!model) die("Can't determine Teensy model from %s\n", filename);
+
+	retval = memory_usage(model);
 
 	if (json) {
 		printf("{\n");
@@ -308,11 +603,16 @@ int main(int argc, char **argv)
 		fflush(fout);
 	}
 
+	// optional analysis reports follow the usual output, on stderr
+	// when the usual output is JSON so stdout remains valid JSON
+	report_out = json ? stderr : fout;
+	analysis_reports(model);
+	fflush(report_out);
+
 	free(filedata);
 	return retval;
 }
 
-size_t output_len = 0;
 char output_buffer[8192];
 
 void line(const char *format, ...)
@@ -331,6 +631,16 @@ void line(const char *format, ...)
 	output_buffer[output_len++] = '\n';
 }
 
+void report(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	if (prefix) fputs(prefix, report_out);
+	vfprintf(report_out, format, args);
+	fputc('\n', report_out);
+	va_end(args);
+}
+
 const char * get_output()
 {
 	output_buffer[output_len] = 0;
@@ -0,0 +1,39 @@
+#ifndef _teensy_size_h
+#define _teensy_size_h
+
+#include <stdint.h>
+
+void die(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+void report(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+
+// padding.c
+void padding_report(int count);
+
+// stack.c
+void stack_report(const char **su_paths, int su_count, int32_t available);
+
+// veneers.c
+void veneers_report(void);
+
+// unreferenced.c
+void unreferenced_report(void);
+
+// boot_cost.c
+#define BOOT_COST_MAX_STEPS 8
+typedef struct {
+	int count;
+	const char *section[BOOT_COST_MAX_STEPS];
+	const char *region[BOOT_COST_MAX_STEPS];
+	int zero[BOOT_COST_MAX_STEPS];
+	uint32_t size[BOOT_COST_MAX_STEPS];
+	double usec[BOOT_COST_MAX_STEPS];
+	uint32_t copied;
+	uint32_t zeroed;
+	double total_usec;
+	double copy_rate;	// MB/sec
+	double zero_rate;
+} boot_cost_t;
+int boot_cost_measure(int model, double copy_rate, double zero_rate, boot_cost_t *bc);
+void boot_cost_report(const boot_cost_t *bc, const boot_cost_t *baseline);
+
+#endif
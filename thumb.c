@@ -0,0 +1,339 @@
+// Thumb-2 code scanning, shared by the call graph based reports
+//
+// Branches are decoded from the bytes of every executable section.
+// ARM mapping symbols ($t, $d) are used to skip literal pools and other
+// data mixed with the code, when the ELF file has them.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "minimal_elf.h"
+#include "thumb.h"
+
+static int function_filter(const elf_symbol_t *sym, void *arg)
+{
+	return ELF_ST_TYPE(sym->info) == STT_FUNC && sym->shndx != 0;
+}
+
+static int function_compare(const void *a, const void *b)
+{
+	const elf_symbol_t *s1 = a, *s2 = b;
+	uint32_t addr1 = s1->value & ~1, addr2 = s2->value & ~1;
+	if (addr1 != addr2) return (addr1 < addr2) ? -1 : 1;
+	// for aliases, prefer global names and the larger size
+	if (ELF_ST_BIND(s1->info) != ELF_ST_BIND(s2->info)) {
+		return (ELF_ST_BIND(s1->info) == 1) ? -1 : (ELF_ST_BIND(s2->info) == 1) ? 1 : 0;
+	}
+	if (s1->size != s2->size) return (s1->size > s2->size) ? -1 : 1;
+	return strcmp(s1->name, s2->name);
+}
+
+// collect all functions, sorted by address, one entry per address.
+// Returns the number of functions, or -1 if there is no symbol table.
+int thumb_functions(thumb_func_t **list)
+{
+	elf_symbol_t *syms;
+	thumb_func_t *funcs;
+	uint32_t sec_addr, sec_size, end;
+	int i, num, count = 0;
+
+	*list = NULL;
+	num = elf_collect_symbols(function_filter, NULL, &syms);
+	if (num < 0) return -1;
+	qsort(syms, num, sizeof(elf_symbol_t), function_compare);
+	funcs = malloc((num ? num : 1) * sizeof(thumb_func_t));
+	if (!funcs) {
+		free(syms);
+		return -1;
+	}
+	for (i=0; i < num; i++) {
+		uint32_t addr = syms[i].value & ~1;
+		if (count > 0 && funcs[count-1].addr == addr) continue;
+		funcs[count].name = syms[i].name;
+		funcs[count].addr = addr;
+		funcs[count].size = syms[i].size;
+		funcs[count].shndx = syms[i].shndx;
+		count++;
+	}
+	free(syms);
+
+	// assembly functions often have no size, assume they end where
+	// the next function begins or at the end of their section
+	for (i=0; i < count; i++) {
+		if (funcs[i].size > 0) continue;
+		if (!elf_get_section(funcs[i].shndx, NULL, &sec_addr, &sec_size, NULL, NULL)) continue;
+		end = sec_addr + sec_size;
+		if (i + 1 < count && funcs[i+1].addr < end && funcs[i+1].addr > funcs[i].addr) {
+			end = funcs[i+1].addr;
+		}
+		if (end > funcs[i].addr) funcs[i].size = end - funcs[i].addr;
+	}
+	*list = funcs;
+	return count;
+}
+
+// index of the function containing addr, or -1
+int thumb_find_function(const thumb_func_t *list, int count, uint32_t addr)
+{
+	int lo = 0, hi = count;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (list[mid].addr <= addr) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == 0) return -1;
+	lo--;
+	if (addr >= list[lo].addr + list[lo].size) return -1;
+	return lo;
+}
+
+// index of the function starting exactly at addr, or -1
+int thumb_function_at(const thumb_func_t *list, int count, uint32_t addr)
+{
+	int i = thumb_find_function(list, count, addr);
+	if (i < 0 || list[i].addr != addr) return -1;
+	return i;
+}
+
+static int mapping_filter(const elf_symbol_t *sym, void *arg)
+{
+	const char *name = sym->name;
+	if (name[0] != '$' || (name[1] != 'd' && name[1] != 't' && name[1] != 'a')) return 0;
+	return name[2] == 0 || name[2] == '.';
+}
+
+static int mapping_compare(const void *a, const void *b)
+{
+	const elf_symbol_t *s1 = a, *s2 = b;
+	if (s1->shndx != s2->shndx) return (s1->shndx < s2->shndx) ? -1 : 1;
+	if (s1->value != s2->value) return (s1->value < s2->value) ? -1 : 1;
+	return 0;
+}
+
+typedef struct {
+	thumb_branch_t *list;
+	int count;
+	int max;
+} branch_list_t;
+
+static void add_branch(branch_list_t *b, uint32_t site, uint32_t target, int kind)
+{
+	if (b->count >= b->max) {
+		int max = b->max ? b->max * 2 : 4096;
+		thumb_branch_t *list = realloc(b->list, max * sizeof(thumb_branch_t));
+		if (!list) return;
+		b->list = list;
+		b->max = max;
+	}
+	b->list[b->count].site = site;
+	b->list[b->count].target = target;
+	b->list[b->count].kind = kind;
+	b->count++;
+}
+
+// decode the Thumb instructions from addr to end, within a section
+static void decode_branches(const unsigned char *data, uint32_t sec_addr, uint32_t sec_size,
+	uint32_t addr, uint32_t end, branch_list_t *b)
+{
+	const unsigned char *code = data + (addr - sec_addr);
+	uint32_t hw1, hw2, pc, s, j1, j2, offset, literal;
+	int rd, mov;
+	uint32_t movw_value[16], movw_valid = 0;
+
+	while (addr + 2 <= end) {
+		hw1 = thumb_read16(code);
+		pc = addr + 4;
+		if ((hw1 & 0xF800) < 0xE800) {
+			// 16 bit instruction
+			if ((hw1 & 0xFF87) == 0x4780) {
+				add_branch(b, addr, 0, BRANCH_INDIRECT);  // BLX Rm
+			} else if ((hw1 & 0xFF87) == 0x4700 && ((hw1 >> 3) & 15) != 14) {
+				add_branch(b, addr, 0, BRANCH_INDIRECT);  // BX Rm
+			} else if ((hw1 & 0xF800) == 0xE000) {
+				offset = (hw1 & 0x7FF) << 1;  // B T2
+				if (offset & 0x800) offset |= 0xFFFFF000;
+				add_branch(b, addr, pc + offset, BRANCH_JUMP);
+			} else if ((hw1 & 0xF000) == 0xD000 && (hw1 & 0x0E00) != 0x0E00) {
+				offset = (hw1 & 0xFF) << 1;  // B<c> T1
+				if (offset & 0x100) offset |= 0xFFFFFE00;
+				add_branch(b, addr, pc + offset, BRANCH_JUMP);
+			}
+			code += 2;
+			addr += 2;
+			continue;
+		}
+		// 32 bit instruction
+		if (addr + 4 > end) break;
+		hw2 = thumb_read16(code + 2);
+		if ((hw1 & 0xF800) == 0xF000 && (hw2 & 0x8000)) {
+			s = (hw1 >> 10) & 1;
+			j1 = (hw2 >> 13) & 1;
+			j2 = (hw2 >> 11) & 1;
+			if (hw2 & 0x1000) {
+				// BL, BLX or B.W T4, 25 bit offset
+				offset = (s << 24) | ((!(j1 ^ s)) << 23) | ((!(j2 ^ s)) << 22)
+					| ((hw1 & 0x3FF) << 12) | ((hw2 & 0x7FF) << 1);
+				if (s) offset |= 0xFE000000;
+				if (hw2 & 0x4000) {
+					add_branch(b, addr, pc + offset, BRANCH_CALL);
+				} else {
+					add_branch(b, addr, pc + offset, BRANCH_JUMP);
+				}
+			} else if (hw2 & 0x4000) {
+				if (!(hw2 & 1)) {
+					// BLX to ARM code, 4 byte aligned
+					offset = (s << 24) | ((!(j1 ^ s)) << 23) | ((!(j2 ^ s)) << 22)
+						| ((hw1 & 0x3FF) << 12) | ((hw2 & 0x7FE) << 1);
+					if (s) offset |= 0xFE000000;
+					add_branch(b, addr, (pc & ~3) + offset, BRANCH_CALL);
+				}
+			} else if ((hw1 & 0x0380) != 0x0380) {
+				// B<c>.W T3, 21 bit offset
+				offset = (s << 20) | (j2 << 19) | (j1 << 18)
+					| ((hw1 & 0x3F) << 12) | ((hw2 & 0x7FF) << 1);
+				if (s) offset |= 0xFFE00000;
+				add_branch(b, addr, pc + offset, BRANCH_JUMP);
+			}
+		} else if ((mov = thumb_mov_imm(hw1, hw2, &rd, &offset)) != 0) {
+			// MOVW or MOVT, a pair may load an address
+			if (mov == THUMB_MOVW) {
+				movw_value[rd] = offset;
+				movw_valid |= 1 << rd;
+			} else if (movw_valid & (1 << rd)) {
+				add_branch(b, addr, (movw_value[rd] | (offset << 16)) & ~1, BRANCH_ADDRESS);
+				movw_valid &= ~(1 << rd);
+			}
+		} else if ((hw1 & 0xFF7F) == 0xF85F && (hw2 & 0xF000) == 0xF000) {
+			// LDR.W PC, [PC, #imm], as used by long branch veneers
+			literal = (pc & ~3) + ((hw1 & 0x80) ? (hw2 & 0xFFF) : -(hw2 & 0xFFF));
+			if (literal >= sec_addr && literal - sec_addr + 4 <= sec_size) {
+				const unsigned char *p = data + (literal - sec_addr);
+				add_branch(b, addr, (thumb_read16(p) | (thumb_read16(p + 2) << 16)) & ~1, BRANCH_JUMP);
+			} else {
+				add_branch(b, addr, 0, BRANCH_INDIRECT);
+			}
+		}
+		code += 4;
+		addr += 4;
+	}
+}
+
+// decode all branches in the executable sections, in address order
+// within each section.  Returns the number of branches, or -1 on error.
+int thumb_branches(thumb_branch_t **list)
+{
+	elf_symbol_t *maps;
+	branch_list_t b = {NULL, 0, 0};
+	const unsigned char *data;
+	uint32_t sec_addr, sec_size, flags, addr, end, seg_end;
+	unsigned int index;
+	int num_maps, m;
+	char mode;
+
+	*list = NULL;
+	num_maps = elf_collect_symbols(mapping_filter, NULL, &maps);
+	if (num_maps < 0) return -1;
+	qsort(maps, num_maps, sizeof(elf_symbol_t), mapping_compare);
+
+	m = 0;
+	for (index=1; elf_get_section(index, NULL, &sec_addr, &sec_size, &flags, &data); index++) {
+		while (m < num_maps && maps[m].shndx < index) m++;
+		if (!(flags & SHF_EXECINSTR) || !(flags & SHF_ALLOC) || !data) continue;
+		addr = sec_addr;
+		end = sec_addr + sec_size;
+		mode = 't';
+		while (addr < end) {
+			if (m < num_maps && maps[m].shndx == index && maps[m].value <= addr) {
+				mode = maps[m].name[1];
+				m++;
+				continue;
+			}
+			seg_end = end;
+			if (m < num_maps && maps[m].shndx == index && maps[m].value < end) {
+				seg_end = maps[m].value;
+			}
+			if (mode == 't') {
+				decode_branches(data, sec_addr, sec_size, addr, seg_end, &b);
+			}
+			addr = seg_end;
+		}
+	}
+	free(maps);
+	*list = b.list;
+	return b.count;
+}
+
+static uint32_t thumb_expand_imm(uint32_t imm12)
+{
+	uint32_t imm8 = imm12 & 0xFF, rot;
+
+	switch (imm12 >> 8) {
+	  case 0: return imm8;
+	  case 1: return (imm8 << 16) | imm8;
+	  case 2: return (imm8 << 24) | (imm8 << 8);
+	  case 3: return (imm8 << 24) | (imm8 << 16) | (imm8 << 8) | imm8;
+	}
+	imm8 = 0x80 | (imm12 & 0x7F);
+	rot = (imm12 >> 7) & 0x1F;
+	return (imm8 >> rot) | (imm8 << (32 - rot));
+}
+
+static int count_bits(uint32_t n)
+{
+	int count = 0;
+	while (n) {
+		count += n & 1;
+		n >>= 1;
+	}
+	return count;
+}
+
+// estimate a function's stack frame by decoding its prologue, adding
+// up pushed registers and stack pointer adjustments
+uint32_t thumb_frame_estimate(const thumb_func_t *func)
+{
+	const unsigned char *data, *p;
+	uint32_t sec_addr, sec_size, hw1, hw2, imm, frame = 0;
+	int i;
+
+	if (!elf_get_section(func->shndx, NULL, &sec_addr, &sec_size, NULL, &data)) return 0;
+	if (!data || func->addr < sec_addr) return 0;
+	p = data + (func->addr - sec_addr);
+	for (i=0; i < 12 && p + 2 <= data + sec_size && p + 2 <= data + (func->addr - sec_addr) + func->size; i++) {
+		hw1 = thumb_read16(p);
+		if ((hw1 & 0xF800) < 0xE800) {
+			p += 2;
+			if ((hw1 & 0xFE00) == 0xB400) {
+				frame += count_bits(hw1 & 0x1FF) * 4;  // PUSH
+			} else if ((hw1 & 0xFF80) == 0xB080) {
+				frame += (hw1 & 0x7F) * 4;  // SUB SP, #imm
+			} else if ((hw1 & 0xF000) == 0xD000 || (hw1 & 0xF800) == 0xE000
+			  || (hw1 & 0xFF00) == 0x4700 || (hw1 & 0xF500) == 0xB100) {
+				break;  // branch, end of prologue
+			}
+			continue;
+		}
+		if (p + 4 > data + sec_size) break;
+		hw2 = thumb_read16(p + 2);
+		p += 4;
+		if (hw1 == 0xE92D) {
+			frame += count_bits(hw2 & 0x5FFF) * 4;  // PUSH.W
+		} else if (hw1 == 0xF84D && (hw2 & 0x0FFF) == 0x0D04) {
+			frame += 4;  // STR.W Rt, [SP, #-4]!
+		} else if ((hw1 & 0xFFBF) == 0xED2D && (hw2 & 0x0E00) == 0x0A00) {
+			frame += (hw2 & 0xFF) * 4;  // VPUSH
+		} else if ((hw1 & 0xFBEF) == 0xF1AD && (hw2 & 0x8F00) == 0x0D00) {
+			imm = ((hw1 & 0x400) << 1) | ((hw2 & 0x7000) >> 4) | (hw2 & 0xFF);
+			frame += thumb_expand_imm(imm);  // SUB.W SP, SP, #imm
+		} else if ((hw1 & 0xFBFF) == 0xF2AD && (hw2 & 0x8F00) == 0x0D00) {
+			imm = ((hw1 & 0x400) << 1) | ((hw2 & 0x7000) >> 4) | (hw2 & 0xFF);
+			frame += imm;  // SUBW SP, SP, #imm
+		} else if ((hw1 & 0xF800) == 0xF000 && (hw2 & 0x8000)) {
+			break;  // branch, end of prologue
+		}
+	}
+	return frame;
+}
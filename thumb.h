@@ -0,0 +1,49 @@
+#ifndef _thumb_h
+#define _thumb_h
+
+#include <stdint.h>
+
+typedef struct {
+	const char *name;
+	uint32_t addr;		// start address, without the Thumb bit
+	uint32_t size;		// size from the symbol, or distance to the next function
+	uint16_t shndx;
+} thumb_func_t;
+
+#define BRANCH_CALL		1	// BL or BLX to an immediate address
+#define BRANCH_JUMP		2	// B, B.W or LDR PC from a literal, a jump or tail call
+#define BRANCH_INDIRECT		3	// BLX or BX to a register (except BX LR)
+#define BRANCH_ADDRESS		4	// not a branch, MOVW & MOVT forming an address
+
+typedef struct {
+	uint32_t site;		// address of the branch instruction
+	uint32_t target;	// destination, 0 for indirect branches
+	uint8_t kind;
+} thumb_branch_t;
+
+#define THUMB_MOVW	1
+#define THUMB_MOVT	2
+
+// read one little endian halfword of Thumb code
+static inline uint32_t thumb_read16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+// decode a 32 bit MOVW or MOVT with an immediate, returns THUMB_MOVW,
+// THUMB_MOVT or 0 if the instruction is something else
+static inline int thumb_mov_imm(uint32_t hw1, uint32_t hw2, int *rd, uint32_t *imm16)
+{
+	if ((hw1 & 0xFB70) != 0xF240 || (hw2 & 0x8000)) return 0;
+	*rd = (hw2 >> 8) & 15;
+	*imm16 = ((hw1 & 0xF) << 12) | ((hw1 & 0x400) << 1) | ((hw2 & 0x7000) >> 4) | (hw2 & 0xFF);
+	return (hw1 & 0x80) ? THUMB_MOVT : THUMB_MOVW;
+}
+
+int thumb_functions(thumb_func_t **list);
+int thumb_find_function(const thumb_func_t *list, int count, uint32_t addr);
+int thumb_function_at(const thumb_func_t *list, int count, uint32_t addr);
+int thumb_branches(thumb_branch_t **list);
+uint32_t thumb_frame_estimate(const thumb_func_t *func);
+
+#endif
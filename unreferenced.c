@@ -0,0 +1,307 @@
+// Functions which can never be reached from the program's startup
+//
+// The program's functions and data objects form a graph.  Branches and
+// MOVW/MOVT pairs in a function, and words in its literal pool, refer to
+// functions (with the Thumb bit set) or to data objects.  Words inside a
+// data object, like the entries of a vtable or a table of function
+// pointers, are references from that object.  Only the interrupt vectors,
+// the boot headers, the constructor lists and words outside of any known
+// function or object are starting points.  Every function or object
+// referenced by something reached is reached too, so a vtable only keeps
+// its methods when reached code uses the vtable.  Whatever remains was
+// kept only because the linker could not discard it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "minimal_elf.h"
+#include "teensy_size.h"
+#include "thumb.h"
+
+#define MAX_LISTED 50
+
+typedef struct {
+	int from;		// node holding the reference
+	int to;
+} ref_t;
+
+// Functions are nodes 0 to func_count-1, and data objects follow them.
+// Objects are kept in the same form as functions, sorted by address,
+// so thumb_find_function() also finds the object holding an address.
+static thumb_func_t *funcs, *objects;
+static int func_count, object_count, node_count;
+static uint8_t *reached;	// bitmap, one bit per node
+static uint32_t lowest, highest;
+static ref_t *refs;
+static int ref_count, ref_max;
+
+// sections whose contents are used by the hardware or the startup code
+static const char *root_sections[] = {
+	".vectors", ".text.headers", ".preinit_array", ".init_array", ".fini_array", NULL
+};
+
+// objects used by the hardware, where the vectors are part of .text
+static const char *root_objects[] = {
+	"_VectorsFlash", "_VectorsRam", NULL
+};
+
+static inline int is_reached(int i)
+{
+	return reached[i >> 3] & (1 << (i & 7));
+}
+
+static inline void set_reached(int i)
+{
+	reached[i >> 3] |= 1 << (i & 7);
+}
+
+static int is_listed(const char *name, const char **list)
+{
+	for ( ; *list; list++) {
+		if (strcmp(name, *list) == 0) return 1;
+	}
+	return 0;
+}
+
+static int object_filter(const elf_symbol_t *sym, void *arg)
+{
+	return ELF_ST_TYPE(sym->info) == STT_OBJECT && sym->size > 0
+		&& sym->shndx != 0 && sym->shndx < 0xFF00;
+}
+
+static int object_compare(const void *a, const void *b)
+{
+	const elf_symbol_t *s1 = a, *s2 = b;
+	if (s1->value != s2->value) return (s1->value < s2->value) ? -1 : 1;
+	if (s1->size != s2->size) return (s1->size > s2->size) ? -1 : 1;
+	return strcmp(s1->name, s2->name);
+}
+
+// collect the data objects, sorted by address, one entry per address
+static int collect_objects(void)
+{
+	elf_symbol_t *syms;
+	int i, num;
+
+	num = elf_collect_symbols(object_filter, NULL, &syms);
+	if (num < 0) num = 0;
+	qsort(syms, num, sizeof(elf_symbol_t), object_compare);
+	objects = malloc((num ? num : 1) * sizeof(thumb_func_t));
+	if (!objects) die("unable to allocate memory\n");
+	object_count = 0;
+	for (i=0; i < num; i++) {
+		if (object_count > 0 && objects[object_count-1].addr == syms[i].value) continue;
+		objects[object_count].name = syms[i].name;
+		objects[object_count].addr = syms[i].value;
+		objects[object_count].size = syms[i].size;
+		objects[object_count].shndx = syms[i].shndx;
+		object_count++;
+	}
+	free(syms);
+	return object_count;
+}
+
+// the node holding an address, or -1
+static int node_at(uint32_t addr)
+{
+	int i = thumb_find_function(objects, object_count, addr);
+	if (i >= 0) return func_count + i;
+	return thumb_find_function(funcs, func_count, addr);
+}
+
+// add a reference from the node holding site, root = 1 if site is used
+// even when nothing refers to it
+static void add_ref(uint32_t site, int root, int to)
+{
+	int from;
+
+	if (to < 0) return;
+	from = node_at(site);
+	if (from == to) return;
+	if (from < 0 || root) {
+		set_reached(to);
+		if (from >= func_count) set_reached(from);
+		return;
+	}
+	if (ref_count >= ref_max) {
+		int max = ref_max ? ref_max * 2 : 4096;
+		ref_t *list = realloc(refs, max * sizeof(ref_t));
+		if (!list) die("unable to allocate memory\n");
+		refs = list;
+		ref_max = max;
+	}
+	refs[ref_count].from = from;
+	refs[ref_count].to = to;
+	ref_count++;
+}
+
+// the function starting at a code address, or the object holding a data address
+static int target_of(uint32_t value)
+{
+	int i;
+
+	if (value & 1) {
+		value &= ~1;
+		if (value < lowest || value >= highest) return -1;
+		return thumb_function_at(funcs, func_count, value);
+	}
+	i = thumb_find_function(objects, object_count, value);
+	return (i >= 0) ? func_count + i : -1;
+}
+
+// every aligned word in the program's memory which looks like a pointer
+// to Thumb code or into a data object
+static void scan_words(void)
+{
+	const unsigned char *data, *p;
+	const char *name;
+	uint32_t sec_addr, sec_size, flags, word;
+	unsigned int index;
+	int root;
+
+	for (index=1; elf_get_section(index, &name, &sec_addr, &sec_size, &flags, &data); index++) {
+		if (!(flags & SHF_ALLOC) || !data) continue;
+		root = is_listed(name, root_sections);
+		p = data + ((4 - (sec_addr & 3)) & 3);
+		for ( ; p + 4 <= data + sec_size; p += 4) {
+			word = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+			add_ref(sec_addr + (p - data), root, target_of(word));
+		}
+	}
+}
+
+static int ref_compare(const void *a, const void *b)
+{
+	const ref_t *r1 = a, *r2 = b;
+	if (r1->from != r2->from) return r1->from - r2->from;
+	return r1->to - r2->to;
+}
+
+// mark everything reachable from the nodes already marked
+static void follow_refs(void)
+{
+	int *queue, *first, head = 0, tail = 0, i, j;
+
+	qsort(refs, ref_count, sizeof(ref_t), ref_compare);
+	queue = malloc(node_count * sizeof(int));
+	first = malloc((node_count + 1) * sizeof(int));
+	if (!queue || !first) die("unable to allocate memory\n");
+	for (i=0, j=0; i <= node_count; i++) {
+		while (j < ref_count && refs[j].from < i) j++;
+		first[i] = j;
+	}
+	for (i=0; i < node_count; i++) {
+		if (is_reached(i)) queue[tail++] = i;
+	}
+	while (head < tail) {
+		i = queue[head++];
+		for (j = first[i]; j < first[i+1]; j++) {
+			int to = refs[j].to;
+			if (is_reached(to)) continue;
+			set_reached(to);
+			queue[tail++] = to;
+		}
+	}
+	free(first);
+	free(queue);
+}
+
+static int size_compare(const void *a, const void *b)
+{
+	const thumb_func_t *f1 = funcs + *(const int *)a, *f2 = funcs + *(const int *)b;
+	if (f1->size != f2->size) return (f1->size > f2->size) ? -1 : 1;
+	if (f1->addr != f2->addr) return (f1->addr < f2->addr) ? -1 : 1;
+	return 0;
+}
+
+void unreferenced_report(void)
+{
+	thumb_branch_t *branches;
+	const char *section, *done[64];
+	int i, j, n, num, num_done = 0, count = 0, *list;
+	uint32_t bytes, total = 0;
+
+	if (elf_get_architecture() != 40) {
+		report("Unreferenced functions: only supported for ARM");
+		return;
+	}
+	func_count = thumb_functions(&funcs);
+	if (func_count <= 0) {
+		report("Unreferenced functions: no functions in symbol table");
+		free(funcs);
+		return;
+	}
+	collect_objects();
+	node_count = func_count + object_count;
+	reached = calloc((node_count + 7) / 8, 1);
+	list = malloc(func_count * sizeof(int));
+	if (!reached || !list) die("unable to allocate memory\n");
+	lowest = funcs[0].addr;
+	highest = funcs[func_count-1].addr + 1;
+	for (i=0; i < object_count; i++) {
+		if (is_listed(objects[i].name, root_objects)) set_reached(func_count + i);
+	}
+
+	num = thumb_branches(&branches);
+	for (i=0; i < num; i++) {
+		if (branches[i].kind == BRANCH_INDIRECT) continue;
+		if (branches[i].kind == BRANCH_ADDRESS) {
+			// MOVW & MOVT may load a function or an object's address
+			add_ref(branches[i].site, 0, target_of(branches[i].target | 1));
+			add_ref(branches[i].site, 0, target_of(branches[i].target));
+		} else {
+			add_ref(branches[i].site, 0, thumb_function_at(funcs, func_count, branches[i].target));
+		}
+	}
+	free(branches);
+	scan_words();
+	follow_refs();
+
+	for (i=0; i < func_count; i++) {
+		if (is_reached(i)) continue;
+		list[count++] = i;
+		total += funcs[i].size;
+	}
+	report("Unreferenced functions: %d using %u bytes", count, total);
+
+	// totals for each section, in the order sections first appear
+	for (i=0; i < count; i++) {
+		section = elf_section_name_at(funcs[list[i]].addr);
+		if (!section) section = "?";
+		for (j=0; j < num_done; j++) {
+			if (strcmp(done[j], section) == 0) break;
+		}
+		if (j < num_done || num_done >= 64) continue;
+		done[num_done++] = section;
+		for (bytes=0, n=0, j=i; j < count; j++) {
+			const char *s = elf_section_name_at(funcs[list[j]].addr);
+			if (strcmp(s ? s : "?", section) != 0) continue;
+			bytes += funcs[list[j]].size;
+			n++;
+		}
+		report("  %s: %d functions, %u bytes", section, n, bytes);
+	}
+
+	qsort(list, count, sizeof(int), size_compare);
+	for (i=0; i < count && i < MAX_LISTED; i++) {
+		section = elf_section_name_at(funcs[list[i]].addr);
+		report("  %7u  %s (%s)", funcs[list[i]].size, funcs[list[i]].name,
+			section ? section : "?");
+	}
+	if (count > MAX_LISTED) report("  ... %d more", count - MAX_LISTED);
+
+	free(list);
+	free(refs);
+	refs = NULL;
+	ref_count = ref_max = 0;
+	free(reached);
+	reached = NULL;
+	free(objects);
+	objects = NULL;
+	object_count = 0;
+	free(funcs);
+	funcs = NULL;
+	func_count = 0;
+}
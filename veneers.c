@@ -0,0 +1,257 @@
+// Long branch veneers, and the calls which go through them
+//
+// On Teensy 4.x, calls between ITCM (FASTRUN) and flash (FLASHMEM) are
+// too far for BL, so the linker adds a veneer which loads the full
+// address.  Each one costs extra time and takes space in its region.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "minimal_elf.h"
+#include "teensy_size.h"
+#include "thumb.h"
+
+typedef struct {
+	int func;		// index of the veneer in the function list
+	uint32_t target;	// address the veneer jumps to
+	int known;		// target is known
+	const char *section;
+} veneer_t;
+
+typedef struct {
+	int caller;		// function making the call
+	int veneer;		// index into the veneer list
+	int count;		// number of call sites
+} call_pair_t;
+
+static int is_veneer(const char *name)
+{
+	size_t len = strlen(name);
+
+	// GNU ld names veneers "__name_veneer", LLD uses "__XxxThunk_name"
+	if (strncmp(name, "__", 2) == 0 && len > 9 && strcmp(name + len - 7, "_veneer") == 0) {
+		return 1;
+	}
+	return strncmp(name, "__", 2) == 0 && strstr(name, "Thunk_") != NULL;
+}
+
+// find where a veneer jumps to, by decoding its instructions
+static int veneer_target(const thumb_func_t *func, uint32_t *target)
+{
+	const unsigned char *data, *p;
+	uint32_t sec_addr, sec_size, lo, hi;
+	int rd_lo, rd_hi;
+
+	if (!elf_get_section(func->shndx, NULL, &sec_addr, &sec_size, NULL, &data)) return 0;
+	if (!data || func->addr < sec_addr || func->addr - sec_addr + 8 > sec_size) return 0;
+	p = data + (func->addr - sec_addr);
+	if (thumb_read16(p) == 0xF85F && thumb_read16(p + 2) == 0xF000) {
+		// ldr.w pc, [pc, #-0] followed by the address
+		*target = (thumb_read16(p + 4) | (thumb_read16(p + 6) << 16)) & ~1;
+		return 1;
+	}
+	if (func->addr - sec_addr + 10 <= sec_size
+	  && thumb_mov_imm(thumb_read16(p), thumb_read16(p + 2), &rd_lo, &lo) == THUMB_MOVW
+	  && thumb_mov_imm(thumb_read16(p + 4), thumb_read16(p + 6), &rd_hi, &hi) == THUMB_MOVT
+	  && rd_lo == rd_hi) {
+		// movw ip, #lo; movt ip, #hi; bx ip
+		*target = (lo | (hi << 16)) & ~1;
+		return 1;
+	}
+	return 0;
+}
+
+// symbols sorted by name, for finding veneer targets by name
+static elf_symbol_t *syms;
+static int *by_name;
+static int sym_count;
+
+static int name_compare(const void *a, const void *b)
+{
+	int i1 = *(const int *)a, i2 = *(const int *)b;
+	int n = strcmp(syms[i1].name, syms[i2].name);
+	if (n) return n;
+	return i1 - i2;  // duplicates keep symbol table order
+}
+
+// find the first symbol with this name, like elf_get_symbol() but
+// without scanning the whole symbol table for every veneer
+static int lookup_symbol(const char *name, uint32_t *value)
+{
+	int lo = 0, hi, mid, i;
+
+	if (!by_name) {
+		sym_count = elf_collect_symbols(NULL, NULL, &syms);
+		if (sym_count < 0) sym_count = 0;
+		by_name = malloc((sym_count ? sym_count : 1) * sizeof(int));
+		if (!by_name) die("unable to allocate memory\n");
+		for (i=0; i < sym_count; i++) by_name[i] = i;
+		qsort(by_name, sym_count, sizeof(int), name_compare);
+	}
+	hi = sym_count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strcmp(syms[by_name[mid]].name, name) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo >= sym_count || strcmp(syms[by_name[lo]].name, name) != 0) return 0;
+	*value = syms[by_name[lo]].value;
+	return 1;
+}
+
+static void free_symbols(void)
+{
+	free(by_name);
+	free(syms);
+	by_name = NULL;
+	syms = NULL;
+	sym_count = 0;
+}
+
+static int pair_compare(const void *a, const void *b)
+{
+	const call_pair_t *p1 = a, *p2 = b;
+	if (p1->caller != p2->caller) return p1->caller - p2->caller;
+	return p1->veneer - p2->veneer;
+}
+
+static int count_compare(const void *a, const void *b)
+{
+	const call_pair_t *p1 = a, *p2 = b;
+	if (p1->count != p2->count) return p2->count - p1->count;
+	return pair_compare(a, b);
+}
+
+static const char * function_name(const thumb_func_t *funcs, int count, uint32_t addr)
+{
+	int i = thumb_function_at(funcs, count, addr);
+	return (i >= 0) ? funcs[i].name : "?";
+}
+
+void veneers_report(void)
+{
+	thumb_func_t *funcs;
+	thumb_branch_t *branches;
+	veneer_t *veneers;
+	call_pair_t *pairs;
+	int *veneer_index;
+	int i, n, func_count, branch_count, veneer_count = 0, pair_count = 0;
+	uint32_t total_bytes = 0;
+
+	if (elf_get_architecture() != 40) {
+		report("Veneers: only supported for ARM");
+		return;
+	}
+	func_count = thumb_functions(&funcs);
+	if (func_count < 0) {
+		report("Veneers: no symbol table");
+		return;
+	}
+	veneers = malloc((func_count ? func_count : 1) * sizeof(veneer_t));
+	veneer_index = malloc((func_count ? func_count : 1) * sizeof(int));
+	if (!veneers || !veneer_index) die("unable to allocate memory\n");
+	for (i=0; i < func_count; i++) {
+		veneer_index[i] = -1;
+		if (!is_veneer(funcs[i].name)) continue;
+		veneer_index[i] = veneer_count;
+		veneers[veneer_count].func = i;
+		veneers[veneer_count].known = veneer_target(funcs + i, &veneers[veneer_count].target);
+		if (!veneers[veneer_count].known) {
+			// unknown instructions, try the name instead
+			char name[256];
+			uint32_t value;
+			const char *p = strstr(funcs[i].name, "Thunk_");
+			if (p) {
+				snprintf(name, sizeof(name), "%s", p + 6);
+			} else {
+				p = funcs[i].name + 2;
+				snprintf(name, sizeof(name), "%.*s", (int)(strlen(p) - 7), p);
+			}
+			if (lookup_symbol(name, &value)) {
+				veneers[veneer_count].target = value & ~1;
+				veneers[veneer_count].known = 1;
+			}
+		}
+		veneers[veneer_count].section = elf_section_name_at(funcs[i].addr);
+		if (!veneers[veneer_count].section) veneers[veneer_count].section = "?";
+		total_bytes += funcs[i].size;
+		veneer_count++;
+	}
+	if (veneer_count == 0) {
+		report("Veneers: none");
+		free_symbols();
+		free(veneer_index);
+		free(veneers);
+		free(funcs);
+		return;
+	}
+
+	// count the call sites for each caller and veneer
+	branch_count = thumb_branches(&branches);
+	pairs = malloc((branch_count > 0 ? branch_count : 1) * sizeof(call_pair_t));
+	if (!pairs) die("unable to allocate memory\n");
+	for (i=0; i < branch_count; i++) {
+		if (branches[i].kind == BRANCH_INDIRECT || branches[i].kind == BRANCH_ADDRESS) continue;
+		int f = thumb_function_at(funcs, func_count, branches[i].target);
+		if (f < 0 || veneer_index[f] < 0) continue;
+		pairs[pair_count].caller = thumb_find_function(funcs, func_count, branches[i].site);
+		pairs[pair_count].veneer = veneer_index[f];
+		pairs[pair_count].count = 1;
+		pair_count++;
+	}
+	free(branches);
+	qsort(pairs, pair_count, sizeof(call_pair_t), pair_compare);
+	for (i=0, n=0; i < pair_count; i++) {
+		if (n > 0 && pair_compare(pairs + n - 1, pairs + i) == 0) {
+			pairs[n-1].count++;
+		} else {
+			pairs[n++] = pairs[i];
+		}
+	}
+	pair_count = n;
+	qsort(pairs, pair_count, sizeof(call_pair_t), count_compare);
+
+	report("Veneers: %d using %u bytes", veneer_count, total_bytes);
+	for (i=0; i < veneer_count; i++) {
+		const char *section = veneers[i].section;
+		uint32_t bytes = 0;
+		int j, num = 0;
+		for (j=0; j < i; j++) {
+			if (strcmp(veneers[j].section, section) == 0) break;
+		}
+		if (j < i) continue;  // this section already printed
+		for (j=i; j < veneer_count; j++) {
+			if (strcmp(veneers[j].section, section) != 0) continue;
+			bytes += funcs[veneers[j].func].size;
+			num++;
+		}
+		report("  %s: %d veneers, %u bytes", section, num, bytes);
+	}
+	report("  calls  caller -> callee");
+	for (i=0; i < pair_count; i++) {
+		const veneer_t *v = veneers + pairs[i].veneer;
+		const char *caller = (pairs[i].caller >= 0) ? funcs[pairs[i].caller].name : "?";
+		const char *from = (pairs[i].caller >= 0) ?
+			elf_section_name_at(funcs[pairs[i].caller].addr) : NULL;
+		const char *to = v->known ? elf_section_name_at(v->target) : NULL;
+		report("  %5d  %s (%s) -> %s (%s)%s", pairs[i].count,
+			caller, from ? from : "?",
+			v->known ? function_name(funcs, func_count, v->target) : funcs[v->func].name,
+			to ? to : "?",
+			(from && to && strcmp(from, to) == 0) ? ", same region" : "");
+	}
+	for (i=0; i < veneer_count; i++) {
+		int j;
+		for (j=0; j < pair_count && pairs[j].veneer != i; j++) ;
+		if (j == pair_count) {
+			report("  %5d  %s, no direct calls", 0, funcs[veneers[i].func].name);
+		}
+	}
+	free(pairs);
+	free_symbols();
+	free(veneer_index);
+	free(veneers);
+	free(funcs);
+}